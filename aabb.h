@@ -0,0 +1,388 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "mat4.h"
+#include "vec3.h"
+
+// 3D AABB, 从gfx_tree.cpp里面拿出来, 多个test共用.
+struct AABB {
+    vec3 min, max;
+    static AABB empty() {
+        return {vec3(+INFINITY), vec3(-INFINITY)};
+    }
+    static AABB fromMinMax(const vec3& mn, const vec3& mx) { return {mn, mx}; }
+    static AABB fromCenterExtent(const vec3& c, const vec3& e) { return {c - e, c + e}; }
+    static AABB merge(const AABB& a, const AABB& b) {
+        return {
+            vec3(std::min(a.min.x, b.min.x), std::min(a.min.y, b.min.y), std::min(a.min.z, b.min.z)),
+            vec3(std::max(a.max.x, b.max.x), std::max(a.max.y, b.max.y), std::max(a.max.z, b.max.z))};
+    }
+
+    bool isEmpty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+    vec3 center() const { return (min + max) * 0.5f; }
+    vec3 extent() const { return (max - min) * 0.5f; }
+
+    AABB translated(const vec3& t) const { return {min + t, max + t}; }
+
+    // 通用仿射变换, center/extent法, 不用逐个变换8个角:
+    //   c' = M * c
+    //   e' = |R| * e, R是M左上3x3
+    // empty的AABB变换完还是empty (inf运算会得到nan).
+    AABB transformed(const mat4& M) const {
+        if (isEmpty()) return empty();
+        vec3 c = center();
+        vec3 e = extent();
+        vec3 c2 = transformPoint(M, c);
+        vec3 e2 = {std::abs(M.m[0][0]) * e.x + std::abs(M.m[1][0]) * e.y + std::abs(M.m[2][0]) * e.z,
+                   std::abs(M.m[0][1]) * e.x + std::abs(M.m[1][1]) * e.y + std::abs(M.m[2][1]) * e.z,
+                   std::abs(M.m[0][2]) * e.x + std::abs(M.m[1][2]) * e.y + std::abs(M.m[2][2]) * e.z};
+        return fromCenterExtent(c2, e2);
+    }
+};
+
+//=========================================================
+// 视锥裁剪, 推导见gfx_tree.cpp里面的注释.
+// 平面: dot(n, p) + d = 0, n是单位向量, 朝向视锥里面, dot(n, p) + d >= 0 的点在这个平面的里侧.
+struct Plane {
+    vec3 n;
+    float d;
+    float distance(const vec3& p) const { return dot(n, p) + d; }
+};
+
+// 约定顺序: L, R, B, T, N, F
+struct Frustum {
+    Plane planes[6];
+
+    // 测试用: 一个长方体的"视锥", 6个面就是AABB的6个面.
+    static Frustum fromBox(const AABB& b) {
+        return {{{{1, 0, 0}, -b.min.x}, {{-1, 0, 0}, b.max.x},
+                 {{0, 1, 0}, -b.min.y}, {{0, -1, 0}, b.max.y},
+                 {{0, 0, 1}, -b.min.z}, {{0, 0, -1}, b.max.z}}};
+    }
+
+    // 从view-projection矩阵里抽出6个平面 (Gribb-Hartmann), OpenGL的NDC, 顺序也是左右下上近远.
+    // 第i行是 (m[0][i], m[1][i], m[2][i], m[3][i]), 左平面 = row3 + row0, 右平面 = row3 - row0, 以此类推.
+    static Frustum fromMatrix(const mat4& vp) {
+        Frustum f;
+        for (int i = 0; i < 6; ++i) {
+            int row = i / 2;
+            float sign = (i % 2 == 0) ? 1.0f : -1.0f;
+            vec3 n = {vp.m[0][3] + sign * vp.m[0][row], vp.m[1][3] + sign * vp.m[1][row],
+                      vp.m[2][3] + sign * vp.m[2][row]};
+            float d = vp.m[3][3] + sign * vp.m[3][row];
+            float len = length(n);
+            f.planes[i] = {n * (1.0f / len), d / len};
+        }
+        return f;
+    }
+};
+
+// 中心-半径法: AABB在法线方向的投影半径 r = dot(|n|, e), 中心到平面距离 s = dot(n, c) + d,
+// s + r < 0 就完全在这个平面外面. 保守测试, 只会多留, 不会错剔.
+// planeTests: 可选, 累加做了几次平面测试.
+inline bool aabbInsideFrustum(const AABB& b, const Frustum& f, size_t* planeTests = nullptr) {
+    if (b.isEmpty()) return false;
+    const vec3 c = b.center();
+    const vec3 e = b.extent();
+    for (int i = 0; i < 6; ++i) {
+        if (planeTests) (*planeTests)++;
+        const vec3& n = f.planes[i].n;
+        float r = std::abs(n.x) * e.x + std::abs(n.y) * e.y + std::abs(n.z) * e.z;
+        float s = f.planes[i].distance(c);
+        if (s + r < 0) return false;
+    }
+    return true;
+}
+
+// 层次裁剪用的版本, 只测mask里的平面 (bit i 对应 planes[i]):
+//   s + r < 0   完全在平面外, 剔除, 记下是哪个平面 (lastReject), 下一帧先测它, 大概率还是它.
+//   s - r >= 0  完全在平面里, 孩子都在父节点的AABB里面, 不用再测这个平面, 从mask里去掉.
+// 返回孩子要继续测的mask, 0代表整个在视锥里面; 被剔除返回CULL_OUTSIDE.
+constexpr uint32_t CULL_ALL_PLANES = 0x3f;
+constexpr uint32_t CULL_OUTSIDE = UINT32_MAX;
+
+inline uint32_t cullPlanes(const AABB& b, const Frustum& f, uint32_t mask, int& lastReject, size_t* planeTests = nullptr) {
+    if (b.isEmpty()) return CULL_OUTSIDE;
+    const vec3 c = b.center();
+    const vec3 e = b.extent();
+    // -1: 外面, 0: 相交, 1: 里面
+    auto classify = [&](int i) {
+        if (planeTests) (*planeTests)++;
+        const vec3& n = f.planes[i].n;
+        float r = std::abs(n.x) * e.x + std::abs(n.y) * e.y + std::abs(n.z) * e.z;
+        float s = f.planes[i].distance(c);
+        if (s + r < 0) return -1;
+        return (s - r >= 0) ? 1 : 0;
+    };
+
+    int first = (lastReject >= 0 && (mask >> lastReject & 1)) ? lastReject : -1;
+    if (first >= 0) {
+        int res = classify(first);
+        if (res < 0) return CULL_OUTSIDE;
+        if (res > 0) mask &= ~(1u << first);
+    }
+    for (int i = 0; i < 6; ++i) {
+        if (i == first || !(mask >> i & 1)) continue;
+        int res = classify(i);
+        if (res < 0) {
+            lastReject = i;
+            return CULL_OUTSIDE;
+        }
+        if (res > 0) mask &= ~(1u << i);
+    }
+    return mask;
+}
+
+//=========================================================
+// SoA存很多个AABB, 给batch kernel用.
+// 每个分量一个连续数组, 一次load 8个box的同一个分量.
+struct AABBSoA {
+    std::vector<float> minX, minY, minZ;
+    std::vector<float> maxX, maxY, maxZ;
+
+    size_t size() const { return minX.size(); }
+    void resize(size_t n) {
+        minX.resize(n), minY.resize(n), minZ.resize(n);
+        maxX.resize(n), maxY.resize(n), maxZ.resize(n);
+    }
+    void set(size_t i, const AABB& b) {
+        minX[i] = b.min.x, minY[i] = b.min.y, minZ[i] = b.min.z;
+        maxX[i] = b.max.x, maxY[i] = b.max.y, maxZ[i] = b.max.z;
+    }
+    void push_back(const AABB& b) {
+        resize(size() + 1);
+        set(size() - 1, b);
+    }
+    AABB get(size_t i) const {
+        return {{minX[i], minY[i], minZ[i]}, {maxX[i], maxY[i], maxZ[i]}};
+    }
+};
+
+#ifdef __AVX2__
+// 8个box, m[col][row]是8个box各自的矩阵元素 (可以是同一个矩阵broadcast出来的).
+// 运算顺序和AABB::transformed一样, 结果bit-exact.
+inline void transformAABB8(const AABBSoA& in, AABBSoA& out, size_t i, const __m256 m[4][3]) {
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+    __m256 mn[3] = {_mm256_loadu_ps(&in.minX[i]), _mm256_loadu_ps(&in.minY[i]), _mm256_loadu_ps(&in.minZ[i])};
+    __m256 mx[3] = {_mm256_loadu_ps(&in.maxX[i]), _mm256_loadu_ps(&in.maxY[i]), _mm256_loadu_ps(&in.maxZ[i])};
+
+    // empty的box (任意分量min > max) 最后原样写回empty
+    __m256 emptyMask = _mm256_setzero_ps();
+    __m256 c[3], e[3];
+    for (int k = 0; k < 3; ++k) {
+        emptyMask = _mm256_or_ps(emptyMask, _mm256_cmp_ps(mn[k], mx[k], _CMP_GT_OQ));
+        c[k] = _mm256_mul_ps(_mm256_add_ps(mn[k], mx[k]), half);
+        e[k] = _mm256_mul_ps(_mm256_sub_ps(mx[k], mn[k]), half);
+    }
+
+    float* outMin[3] = {&out.minX[i], &out.minY[i], &out.minZ[i]};
+    float* outMax[3] = {&out.maxX[i], &out.maxY[i], &out.maxZ[i]};
+    const __m256 posInf = _mm256_set1_ps(+INFINITY);
+    const __m256 negInf = _mm256_set1_ps(-INFINITY);
+    for (int r = 0; r < 3; ++r) {
+        __m256 c2 = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[0][r], c[0]),
+                                                               _mm256_mul_ps(m[1][r], c[1])),
+                                                 _mm256_mul_ps(m[2][r], c[2])),
+                                   m[3][r]);
+        __m256 e2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_and_ps(m[0][r], absMask), e[0]),
+                                                _mm256_mul_ps(_mm256_and_ps(m[1][r], absMask), e[1])),
+                                  _mm256_mul_ps(_mm256_and_ps(m[2][r], absMask), e[2]));
+        _mm256_storeu_ps(outMin[r], _mm256_blendv_ps(_mm256_sub_ps(c2, e2), posInf, emptyMask));
+        _mm256_storeu_ps(outMax[r], _mm256_blendv_ps(_mm256_add_ps(c2, e2), negInf, emptyMask));
+    }
+}
+#endif
+
+// 所有box用同一个矩阵, e.g. 同一个父节点下的一批物体.
+// out可以就是in.
+inline void transformAABBs(const AABBSoA& in, const mat4& M, AABBSoA& out) {
+    const size_t n = in.size();
+    out.resize(n);
+    size_t i = 0;
+#ifdef __AVX2__
+    __m256 m[4][3];
+    for (int c = 0; c < 4; ++c)
+        for (int r = 0; r < 3; ++r)
+            m[c][r] = _mm256_set1_ps(M.m[c][r]);
+    for (; i + 8 <= n; i += 8) {
+        transformAABB8(in, out, i, m);
+    }
+#endif
+    for (; i < n; ++i) {
+        out.set(i, in.get(i).transformed(M));
+    }
+}
+
+// 每个box一个矩阵, perBox[i]对应第i个box, e.g. 每个dynamic node的world matrix.
+inline void transformAABBs(const AABBSoA& in, const mat4* perBox, AABBSoA& out) {
+    const size_t n = in.size();
+    out.resize(n);
+    size_t i = 0;
+#ifdef __AVX2__
+    // 8个矩阵同一个元素之间的距离是16个float, gather出来转成SoA.
+    const __m256i stride = _mm256_setr_epi32(0, 16, 32, 48, 64, 80, 96, 112);
+    for (; i + 8 <= n; i += 8) {
+        const float* base = &perBox[i].m[0][0];
+        __m256 m[4][3];
+        for (int c = 0; c < 4; ++c)
+            for (int r = 0; r < 3; ++r)
+                m[c][r] = _mm256_i32gather_ps(base + c * 4 + r, stride, 4);
+        transformAABB8(in, out, i, m);
+    }
+#endif
+    for (; i < n; ++i) {
+        out.set(i, in.get(i).transformed(perBox[i]));
+    }
+}
+
+//=========================================================
+// 批量视锥裁剪: SoA存center/extent, AVX2一次测8个box对6个平面.
+// 和aabbInsideFrustum是一样的公式和运算顺序, 结果一致.
+// empty的box存成 center=0, extent=EMPTY_EXTENT, 投影半径r是一个很大的负数, 一定被剔除.
+// 不用-inf, 法线分量是0的时候 0 * -inf = nan.
+struct CenterExtentSoA {
+    std::vector<float> cx, cy, cz;
+    std::vector<float> ex, ey, ez;
+
+    size_t size() const { return count; }
+    // 数组后面多留8个empty的位置, kernel从任意begin开始load 8个都不会越界,
+    // 超出end的lane用mask去掉.
+    void resize(size_t n) {
+        count = n;
+        for (auto* v : {&cx, &cy, &cz}) v->resize(n + PAD, 0.0f);
+        for (auto* v : {&ex, &ey, &ez}) v->resize(n + PAD, EMPTY_EXTENT);
+    }
+    void set(size_t i, const AABB& b) {
+        if (b.isEmpty()) {
+            cx[i] = cy[i] = cz[i] = 0.0f;
+            ex[i] = ey[i] = ez[i] = EMPTY_EXTENT;
+            return;
+        }
+        vec3 c = b.center(), e = b.extent();
+        cx[i] = c.x, cy[i] = c.y, cz[i] = c.z;
+        ex[i] = e.x, ey[i] = e.y, ez[i] = e.z;
+    }
+    void push_back(const AABB& b) {
+        resize(count + 1);
+        set(count - 1, b);
+    }
+
+    static constexpr size_t PAD = 8;
+    static constexpr float EMPTY_EXTENT = -1e30f;
+
+private:
+    size_t count = 0;
+};
+
+// 一个box对一个平面, 和aabbInsideFrustum里面一样.
+inline bool insidePlane(const Plane& p, float cx, float cy, float cz, float ex, float ey, float ez) {
+    float r = std::abs(p.n.x) * ex + std::abs(p.n.y) * ey + std::abs(p.n.z) * ez;
+    float s = p.n.x * cx + p.n.y * cy + p.n.z * cz + p.d;
+    return !(s + r < 0);
+}
+
+#ifdef __AVX2__
+// 8个box [i, i+8) 对6个平面, 返回8bit的可见mask, bit k对应box i+k.
+inline uint32_t cullAABB8(const CenterExtentSoA& b, size_t i, const Frustum& f) {
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 cx = _mm256_loadu_ps(&b.cx[i]), cy = _mm256_loadu_ps(&b.cy[i]), cz = _mm256_loadu_ps(&b.cz[i]);
+    __m256 ex = _mm256_loadu_ps(&b.ex[i]), ey = _mm256_loadu_ps(&b.ey[i]), ez = _mm256_loadu_ps(&b.ez[i]);
+    __m256 visible = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (int k = 0; k < 6; ++k) {
+        const Plane& p = f.planes[k];
+        __m256 nx = _mm256_set1_ps(p.n.x), ny = _mm256_set1_ps(p.n.y), nz = _mm256_set1_ps(p.n.z);
+        __m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_and_ps(nx, absMask), ex),
+                                               _mm256_mul_ps(_mm256_and_ps(ny, absMask), ey)),
+                                 _mm256_mul_ps(_mm256_and_ps(nz, absMask), ez));
+        __m256 s = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, cx), _mm256_mul_ps(ny, cy)),
+                                               _mm256_mul_ps(nz, cz)),
+                                 _mm256_set1_ps(p.d));
+        // !(s + r < 0), nan当作可见, 和标量版本一致
+        visible = _mm256_and_ps(visible, _mm256_cmp_ps(_mm256_add_ps(s, r), zero, _CMP_NLT_UQ));
+        if (_mm256_testz_ps(visible, visible)) return 0;  // 8个全部剔除了
+    }
+    return (uint32_t)_mm256_movemask_ps(visible);
+}
+
+// compress-store用的表: mask -> 把置位的lane挪到前面的permute下标.
+inline const __m256i* compressTable() {
+    alignas(32) static int32_t table[256][8];
+    static bool init = [] {
+        for (int m = 0; m < 256; ++m) {
+            int k = 0;
+            for (int lane = 0; lane < 8; ++lane)
+                if (m & (1 << lane)) table[m][k++] = lane;
+            while (k < 8) table[m][k++] = 0;
+        }
+        return true;
+    }();
+    (void)init;
+    return reinterpret_cast<const __m256i*>(table);
+}
+#endif
+
+// [begin, end) 里面可见的box, 下标追加到out后面.
+inline void cullAABBs(const CenterExtentSoA& b, size_t begin, size_t end, const Frustum& f, std::vector<uint32_t>& out) {
+    size_t i = begin;
+#ifdef __AVX2__
+    const __m256i* table = compressTable();
+    size_t outCnt = out.size();
+    // compress-store每次写满8个, 预留位置
+    out.resize(outCnt + (end - begin) + 8);
+    for (; i < end; i += 8) {
+        uint32_t mask = cullAABB8(b, i, f);
+        // 超出end的lane读到的是别的box或者padding, 去掉
+        if (end - i < 8) mask &= (1u << (end - i)) - 1;
+        __m256i idx = _mm256_add_epi32(_mm256_set1_epi32((int)i), _mm256_load_si256(&table[mask]));
+        _mm256_storeu_si256((__m256i*)&out[outCnt], idx);
+        outCnt += __builtin_popcount(mask);
+    }
+    out.resize(outCnt);
+#endif
+    for (; i < end; ++i) {
+        bool vis = true;
+        for (int k = 0; k < 6 && vis; ++k) {
+            vis = insidePlane(f.planes[k], b.cx[i], b.cy[i], b.cz[i], b.ex[i], b.ey[i], b.ez[i]);
+        }
+        if (vis) out.push_back((uint32_t)i);
+    }
+}
+
+inline void cullAABBs(const CenterExtentSoA& b, const Frustum& f, std::vector<uint32_t>& out) {
+    cullAABBs(b, 0, b.size(), f, out);
+}
+
+// bitmask版本, mask[i / 8]的bit (i % 8) 代表box i是否可见.
+inline void cullAABBsMask(const CenterExtentSoA& b, const Frustum& f, std::vector<uint8_t>& mask) {
+    const size_t n = b.size();
+    mask.assign((n + 7) / 8, 0);
+    size_t i = 0;
+#ifdef __AVX2__
+    for (; i < n; i += 8) {
+        uint32_t m = cullAABB8(b, i, f);
+        if (n - i < 8) m &= (1u << (n - i)) - 1;
+        mask[i / 8] = (uint8_t)m;
+    }
+#endif
+    for (; i < n; ++i) {
+        bool vis = true;
+        for (int k = 0; k < 6 && vis; ++k) {
+            vis = insidePlane(f.planes[k], b.cx[i], b.cy[i], b.cz[i], b.ex[i], b.ey[i], b.ez[i]);
+        }
+        if (vis) mask[i / 8] |= (uint8_t)(1u << (i % 8));
+    }
+}
+
+#endif  // AABB_H
@@ -7,9 +7,12 @@ namespace constructor_basic   { void cppMain(); }
 namespace design_pattern      { void cppMain(); }
 namespace destructor_basic    { void cppMain(); }
 namespace dijkstra            { void cppMain(); }
+namespace gfx_bvh             { void cppMain(); }
+namespace gfx_octree          { void cppMain(); }
 namespace gfx_quad_tree       { void cppMain(); }
 namespace gfx_tree            { void cppMain(); }
 namespace gfx_vec3            { void cppMain(); }
+namespace gfx_vertex_format   { void cppMain(); }
 namespace impl_pq             { void cppMain(); }
 namespace impl_semaphore      { void cppMain(); }
 namespace impl_shared_ptr     { void cppMain(); }
@@ -40,9 +43,12 @@ map<string, function<void()>> testMap = {
     { "design_pattern",     design_pattern      ::cppMain },
     { "destructor_basic",   destructor_basic    ::cppMain },
     { "dijkstra",           dijkstra            ::cppMain },
+    { "gfx_bvh",            gfx_bvh             ::cppMain },
+    { "gfx_octree",         gfx_octree          ::cppMain },
     { "gfx_quad_tree",      gfx_quad_tree       ::cppMain },
     { "gfx_tree",           gfx_tree            ::cppMain },
     { "gfx_vec3",           gfx_vec3            ::cppMain },
+    { "gfx_vertex_format",  gfx_vertex_format   ::cppMain },
     { "impl_pq",            impl_pq             ::cppMain },
     { "impl_semaphore",     impl_semaphore      ::cppMain },
     { "impl_shared_ptr",    impl_shared_ptr     ::cppMain },
@@ -36,6 +36,8 @@ int main(int argc, char** argv) {
     unordered_set<string> memoryTrackerBlackList = {
         "impl_shared_ptr",  // todo, fixme
         "new_delete",       // todo, fixme
+        "gfx_bvh",   // 后台rebuild
+        "gfx_tree",  // 有work-stealing线程池
         "impl_semaphore",
         "thread_basic",
         "thread_example",
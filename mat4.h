@@ -0,0 +1,107 @@
+#ifndef MAT4_H
+#define MAT4_H
+
+#include "vec3.h"
+
+// 最小的4x4矩阵, 和glm一样是column-major: m[col][row].
+// 只实现scene graph / AABB变换要用到的部分.
+struct mat4 {
+    float m[4][4];
+
+    // 默认单位矩阵
+    mat4() {
+        for (int c = 0; c < 4; ++c)
+            for (int r = 0; r < 4; ++r)
+                m[c][r] = (c == r) ? 1.0f : 0.0f;
+    }
+
+    vec3 col(int c) const { return {m[c][0], m[c][1], m[c][2]}; }
+};
+
+inline mat4 operator*(const mat4& a, const mat4& b) {
+    mat4 res;
+    for (int c = 0; c < 4; ++c) {
+        for (int r = 0; r < 4; ++r) {
+            res.m[c][r] = a.m[0][r] * b.m[c][0] + a.m[1][r] * b.m[c][1] +
+                          a.m[2][r] * b.m[c][2] + a.m[3][r] * b.m[c][3];
+        }
+    }
+    return res;
+}
+
+inline mat4 translate(const vec3& t) {
+    mat4 res;
+    res.m[3][0] = t.x;
+    res.m[3][1] = t.y;
+    res.m[3][2] = t.z;
+    return res;
+}
+
+inline mat4 scale(const vec3& s) {
+    mat4 res;
+    res.m[0][0] = s.x;
+    res.m[1][1] = s.y;
+    res.m[2][2] = s.z;
+    return res;
+}
+
+// 绕z轴转, 弧度
+inline mat4 rotateZ(float rad) {
+    mat4 res;
+    float c = cos(rad), s = sin(rad);
+    res.m[0][0] = c;
+    res.m[0][1] = s;
+    res.m[1][0] = -s;
+    res.m[1][1] = c;
+    return res;
+}
+
+// w=1的点, 带平移
+inline vec3 transformPoint(const mat4& M, const vec3& p) {
+    return {M.m[0][0] * p.x + M.m[1][0] * p.y + M.m[2][0] * p.z + M.m[3][0],
+            M.m[0][1] * p.x + M.m[1][1] * p.y + M.m[2][1] * p.z + M.m[3][1],
+            M.m[0][2] * p.x + M.m[1][2] * p.y + M.m[2][2] * p.z + M.m[3][2]};
+}
+
+// 齐次坐标, w=1, 结果是clip space (x, y, z, w), 透视除法留给调用的人.
+inline void transformClip(const mat4& M, const vec3& p, float out[4]) {
+    for (int r = 0; r < 4; ++r) {
+        out[r] = M.m[0][r] * p.x + M.m[1][r] * p.y + M.m[2][r] * p.z + M.m[3][r];
+    }
+}
+
+// 和glm::perspective一样: 右手系, 看向-z, NDC的z在[-1, 1].
+inline mat4 perspective(float fovyRad, float aspect, float zNear, float zFar) {
+    mat4 res;
+    float t = tan(fovyRad / 2);
+    res.m[0][0] = 1.0f / (aspect * t);
+    res.m[1][1] = 1.0f / t;
+    res.m[2][2] = -(zFar + zNear) / (zFar - zNear);
+    res.m[2][3] = -1.0f;
+    res.m[3][2] = -(2.0f * zFar * zNear) / (zFar - zNear);
+    res.m[3][3] = 0.0f;
+    return res;
+}
+
+// 和glm::lookAt一样, 右手系.
+inline mat4 lookAt(const vec3& eye, const vec3& center, const vec3& up) {
+    vec3 f = normalize(center - eye);
+    vec3 s = normalize(cross(f, up));
+    vec3 u = cross(s, f);
+    mat4 res;
+    res.m[0][0] = s.x;
+    res.m[1][0] = s.y;
+    res.m[2][0] = s.z;
+    res.m[0][1] = u.x;
+    res.m[1][1] = u.y;
+    res.m[2][1] = u.z;
+    res.m[0][2] = -f.x;
+    res.m[1][2] = -f.y;
+    res.m[2][2] = -f.z;
+    res.m[3][0] = -dot(s, eye);
+    res.m[3][1] = -dot(u, eye);
+    res.m[3][2] = dot(f, eye);
+    return res;
+}
+
+#endif  // MAT4_H
@@ -0,0 +1,599 @@
+#include <assert.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>  // rand
+#include <future>
+#include <iostream>
+#include <memory>
+#include <vector>
+using namespace std;
+
+#include "aabb.h"
+#include "vec3.h"
+
+namespace gfx_bvh {
+
+//=========================================================
+// gfx_bvh
+/*
+BVH (bounding volume hierarchy), 给scene graph做视锥裁剪的加速结构.
+    gfx_tree里面的cullAndDraw只能沿着逻辑层次剪枝, 像GIS例子里 World 下面直接挂几千个POI,
+    root的聚合AABB总是可见, 几千个孩子还是要一个一个测.
+    BVH和逻辑层次无关, 只按空间位置把物体的world AABB组织成二叉树, 裁剪时只测路径上的节点.
+
+和gfx_tree里面"聚合AABB"的区别:
+    聚合AABB是挂在逻辑树上的 (车的聚合AABB包括轮子), 逻辑树怎么分组它就怎么分组.
+    BVH只看空间, 离得近的放一起, 每个物体只出现在一个叶子里.
+
+构建: binned SAH (surface area heuristic)
+    一个节点被光线/视锥碰到的概率 ~ 表面积. 划分代价:
+        cost = C_trav + (A_left * N_left + A_right * N_right) / A_parent * C_isect
+    每个轴把质心范围分成BIN_COUNT个桶, 只在桶的边界上试划分, O(n)一层, 比排序后逐个试快.
+    最好的划分都不比直接做叶子划算, 就停下来做叶子.
+
+物体移动:
+    refit: 只更新叶子到root路径上的bounds, 树的结构不变, O(depth). 包围盒变不紧, 质量会下降.
+    质量用SAH cost衡量, 超过build时的REBUILD_RATIO倍, 后台线程用当前bounds的快照重新build,
+    build好了在下一帧的maintain()里换进来, 再做一次整体refit追上这期间的移动.
+
+节点布局:
+    nodes[0]是root, 两个孩子连续存放, left = leftFirst, right = leftFirst + 1.
+    孩子总是在父节点后面分配, 倒着扫一遍就是整体refit.
+
+empty的物体 (没有几何的节点, 或者update成AABB::empty()):
+    质心是NaN, 不能分桶. build的时候放在primIdx最后 [placed, n), 不进任何叶子.
+    之后有了bounds的话, cull的时候这一段单独测, maintain()触发rebuild把它们放进树里.
+*/
+
+struct BVHNode {
+    AABB bounds;
+    uint32_t leftFirst = 0;  // 内部节点: 左孩子下标; 叶子: primIdx里的起始位置
+    uint32_t count = 0;      // 0是内部节点, >0是叶子里物体的个数
+    uint32_t parent = UINT32_MAX;
+    bool isLeaf() const { return count > 0; }
+};
+
+inline float surfaceArea(const AABB& b) {
+    if (b.isEmpty()) return 0;
+    vec3 d = b.max - b.min;
+    return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+// 精确比较, vec3的==带epsilon, refit提前停的时候不能用.
+inline bool sameBounds(const AABB& a, const AABB& b) {
+    return a.min.x == b.min.x && a.min.y == b.min.y && a.min.z == b.min.z &&
+           a.max.x == b.max.x && a.max.y == b.max.y && a.max.z == b.max.z;
+}
+
+inline float axisOf(const vec3& v, int axis) {
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+class BVH {
+public:
+    static constexpr int BIN_COUNT = 12;
+    static constexpr uint32_t MAX_LEAF_SIZE = 8;
+    static constexpr float C_TRAV = 1.0f;
+    // 叶子里的物体用SIMD一次测8个 (aabb.h的cullAABBs), 单个物体的代价比一次节点测试小很多.
+    static constexpr float C_ISECT = 0.25f;
+    static constexpr float REBUILD_RATIO = 1.5f;
+
+    // boxes[i]是物体i的world AABB, 物体id就是下标.
+    void build(const vector<AABB>& boxes) {
+        primBounds = boxes;
+        buildFrom(primBounds);
+        buildLeafBoxes();
+        parkedLive = 0;
+        builtCost = sahCost();
+    }
+
+    size_t nodeCount() const { return nodes.size(); }
+
+    // 物体移动之后调用, 沿着叶子往上更新bounds, 父节点没变就提前停.
+    void update(uint32_t obj, const AABB& b) {
+        if (leafOf[obj] == UINT32_MAX) {
+            parkedLive += int(!b.isEmpty()) - int(!primBounds[obj].isEmpty());
+        }
+        primBounds[obj] = b;
+        leafBoxes.set(posOf[obj], b);
+        for (uint32_t i = leafOf[obj]; i != UINT32_MAX; i = nodes[i].parent) {
+            AABB nb = computeBounds(i);
+            if (sameBounds(nb, nodes[i].bounds)) break;
+            nodes[i].bounds = nb;
+        }
+    }
+
+    // 整体refit, 孩子在父节点后面, 倒着扫一遍.
+    void refit() {
+        for (size_t i = nodes.size(); i-- > 0;) {
+            nodes[i].bounds = computeBounds((uint32_t)i);
+        }
+    }
+
+    // SAH cost, 相对root的表面积归一化. 越小越好.
+    float sahCost() const {
+        if (nodes.empty()) return 0;
+        float rootArea = surfaceArea(nodes[0].bounds);
+        if (rootArea <= 0) return 0;
+        float cost = 0;
+        for (auto& n : nodes) {
+            float p = surfaceArea(n.bounds) / rootArea;
+            cost += n.isLeaf() ? p * n.count * C_ISECT : p * C_TRAV;
+        }
+        return cost;
+    }
+
+    bool rebuilding() const { return pending.valid(); }
+
+    // 每帧call一次:
+    //   后台的build完成了就换进来;
+    //   质量下降太多就启动后台build.
+    // wait=true 会等后台build完成, 测试用.
+    void maintain(bool wait = false) {
+        if (pending.valid()) {
+            if (wait || pending.wait_for(chrono::seconds(0)) == future_status::ready) {
+                unique_ptr<BVH> fresh = pending.get();
+                nodes = move(fresh->nodes);
+                primIdx = move(fresh->primIdx);
+                leafOf = move(fresh->leafOf);
+                placed = fresh->placed;
+                // 后台build用的是快照, 这期间物体可能又动了.
+                buildLeafBoxes();
+                countParkedLive();
+                refit();
+                builtCost = sahCost();
+            }
+            return;
+        }
+        // 不在树里的物体有了bounds, 也要rebuild才能放进去
+        if (parkedLive > 0 || sahCost() > builtCost * REBUILD_RATIO) {
+            // 拷一份bounds的快照给后台线程, 主线程继续用旧的树和update.
+            pending = async(launch::async, [snapshot = primBounds] {
+                auto fresh = make_unique<BVH>();
+                fresh->buildFrom(snapshot);
+                return fresh;
+            });
+            if (wait) maintain(true);
+        }
+    }
+
+    // 可见物体的id放到out里. testCnt返回做了多少次AABB-视锥测试.
+    void cull(const Frustum& fr, vector<uint32_t>& out, size_t* testCnt = nullptr) const {
+        size_t tests = 0;
+        if (parkedLive > 0) {
+            // 不在树里的一段, 和叶子一样测. empty的box测出来总是不可见.
+            size_t mark = out.size();
+            cullAABBs(leafBoxes, placed, primIdx.size(), fr, out);
+            for (size_t k = mark; k < out.size(); ++k) out[k] = primIdx[out[k]];
+            tests += primIdx.size() - placed;
+        }
+        vector<uint32_t> stk;
+        if (!nodes.empty()) stk.push_back(0);
+        while (!stk.empty()) {
+            const BVHNode& n = nodes[stk.back()];
+            stk.pop_back();
+            tests++;
+            if (!aabbInsideFrustum(n.bounds, fr)) continue;
+            if (n.isLeaf()) {
+                // 叶子里的物体在leafBoxes里是连续的, 一次SIMD测完, 再把位置换成物体id.
+                size_t mark = out.size();
+                cullAABBs(leafBoxes, n.leftFirst, n.leftFirst + n.count, fr, out);
+                for (size_t k = mark; k < out.size(); ++k) out[k] = primIdx[out[k]];
+                tests += n.count;
+            } else {
+                stk.push_back(n.leftFirst + 1);
+                stk.push_back(n.leftFirst);
+            }
+        }
+        if (testCnt) *testCnt = tests;
+    }
+
+private:
+    // 按primIdx的顺序把物体的bounds存成SoA, 每个叶子对应连续的一段.
+    void countParkedLive() {
+        parkedLive = 0;
+        for (size_t k = placed; k < primIdx.size(); ++k) parkedLive += !primBounds[primIdx[k]].isEmpty();
+    }
+
+    void buildLeafBoxes() {
+        const size_t n = primIdx.size();
+        leafBoxes.resize(n);
+        posOf.resize(n);
+        for (uint32_t k = 0; k < n; ++k) {
+            posOf[primIdx[k]] = k;
+            leafBoxes.set(k, primBounds[primIdx[k]]);
+        }
+    }
+
+    AABB computeBounds(uint32_t i) const {
+        const BVHNode& n = nodes[i];
+        if (!n.isLeaf()) {
+            return AABB::merge(nodes[n.leftFirst].bounds, nodes[n.leftFirst + 1].bounds);
+        }
+        AABB b = AABB::empty();
+        for (uint32_t k = 0; k < n.count; ++k) {
+            b = AABB::merge(b, primBounds[primIdx[n.leftFirst + k]]);
+        }
+        return b;
+    }
+
+    void buildFrom(const vector<AABB>& boxes) {
+        const uint32_t n = (uint32_t)boxes.size();
+        nodes.clear();
+        primIdx.resize(n);
+        leafOf.assign(n, UINT32_MAX);
+        for (uint32_t i = 0; i < n; ++i) primIdx[i] = i;
+        // empty的放到最后, 不参与建树
+        auto parked = stable_partition(primIdx.begin(), primIdx.end(), [&](uint32_t obj) { return !boxes[obj].isEmpty(); });
+        placed = (uint32_t)(parked - primIdx.begin());
+        if (placed == 0) return;
+
+        nodes.reserve(2 * placed);
+        nodes.emplace_back();
+        nodes[0].leftFirst = 0;
+        nodes[0].count = placed;
+
+        // 用栈代替递归
+        vector<uint32_t> stk = {0};
+        while (!stk.empty()) {
+            uint32_t ni = stk.back();
+            stk.pop_back();
+            subdivide(ni, boxes, stk);
+        }
+    }
+
+    // 限制在[0, BIN_COUNT - 1], 浮点误差或者NaN都不会越界
+    static int binOf(float c, float lo, float binScale) {
+        float f = (c - lo) * binScale;
+        if (!(f > 0)) return 0;
+        return f >= BIN_COUNT ? BIN_COUNT - 1 : (int)f;
+    }
+
+    void subdivide(uint32_t ni, const vector<AABB>& boxes, vector<uint32_t>& stk) {
+        uint32_t first = nodes[ni].leftFirst, count = nodes[ni].count;
+
+        AABB bounds = AABB::empty(), centroidBounds = AABB::empty();
+        for (uint32_t k = first; k < first + count; ++k) {
+            const AABB& b = boxes[primIdx[k]];
+            bounds = AABB::merge(bounds, b);
+            vec3 c = b.center();
+            centroidBounds = AABB::merge(centroidBounds, {c, c});
+        }
+        nodes[ni].bounds = bounds;
+
+        // 找最好的划分: 每个轴BIN_COUNT个桶
+        float bestCost = INFINITY;
+        int bestAxis = -1, bestSplit = -1;
+        for (int axis = 0; axis < 3 && count > 1; ++axis) {
+            float lo = axisOf(centroidBounds.min, axis), hi = axisOf(centroidBounds.max, axis);
+            if (hi <= lo) continue;  // 这个轴上所有质心重合, 分不开
+            float binScale = BIN_COUNT / (hi - lo);
+
+            AABB binBounds[BIN_COUNT];
+            uint32_t binCount[BIN_COUNT] = {};
+            for (int b = 0; b < BIN_COUNT; ++b) binBounds[b] = AABB::empty();
+            for (uint32_t k = first; k < first + count; ++k) {
+                const AABB& box = boxes[primIdx[k]];
+                int b = binOf(axisOf(box.center(), axis), lo, binScale);
+                binCount[b]++;
+                binBounds[b] = AABB::merge(binBounds[b], box);
+            }
+
+            // 左右两边各扫一遍, 算出每个划分位置两侧的面积和个数.
+            float leftArea[BIN_COUNT - 1], rightArea[BIN_COUNT - 1];
+            uint32_t leftCnt[BIN_COUNT - 1], rightCnt[BIN_COUNT - 1];
+            AABB lb = AABB::empty(), rb = AABB::empty();
+            uint32_t lc = 0, rc = 0;
+            for (int s = 0; s < BIN_COUNT - 1; ++s) {
+                lc += binCount[s];
+                lb = AABB::merge(lb, binBounds[s]);
+                leftCnt[s] = lc;
+                leftArea[s] = surfaceArea(lb);
+                rc += binCount[BIN_COUNT - 1 - s];
+                rb = AABB::merge(rb, binBounds[BIN_COUNT - 1 - s]);
+                rightCnt[BIN_COUNT - 2 - s] = rc;
+                rightArea[BIN_COUNT - 2 - s] = surfaceArea(rb);
+            }
+            for (int s = 0; s < BIN_COUNT - 1; ++s) {
+                if (leftCnt[s] == 0 || rightCnt[s] == 0) continue;
+                float cost = leftArea[s] * leftCnt[s] + rightArea[s] * rightCnt[s];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = s;
+                }
+            }
+        }
+
+        float area = surfaceArea(bounds);
+        float leafCost = count * C_ISECT;
+        float splitCost = C_TRAV + (area > 0 ? bestCost / area : 0) * C_ISECT;
+        // 分不开, 或者分开不划算而且叶子不算太大, 就做叶子.
+        if (bestAxis < 0 || (splitCost >= leafCost && count <= MAX_LEAF_SIZE)) {
+            for (uint32_t k = first; k < first + count; ++k) leafOf[primIdx[k]] = ni;
+            return;
+        }
+
+        // 按桶划分primIdx, 和quick sort的partition一样
+        float lo = axisOf(centroidBounds.min, bestAxis), hi = axisOf(centroidBounds.max, bestAxis);
+        float binScale = BIN_COUNT / (hi - lo);
+        auto mid = partition(primIdx.begin() + first, primIdx.begin() + first + count, [&](uint32_t obj) {
+            return binOf(axisOf(boxes[obj].center(), bestAxis), lo, binScale) <= bestSplit;
+        });
+        uint32_t leftCount = (uint32_t)(mid - (primIdx.begin() + first));
+        assert(leftCount > 0 && leftCount < count);
+
+        uint32_t left = (uint32_t)nodes.size();
+        nodes.emplace_back();
+        nodes.emplace_back();
+        nodes[left].leftFirst = first;
+        nodes[left].count = leftCount;
+        nodes[left].parent = ni;
+        nodes[left + 1].leftFirst = first + leftCount;
+        nodes[left + 1].count = count - leftCount;
+        nodes[left + 1].parent = ni;
+        nodes[ni].leftFirst = left;
+        nodes[ni].count = 0;
+
+        stk.push_back(left + 1);
+        stk.push_back(left);
+    }
+
+    vector<BVHNode> nodes;
+    vector<uint32_t> primIdx;  // 叶子引用这里的一段, 存的是物体id
+    vector<AABB> primBounds;   // 物体id -> 当前world AABB
+    vector<uint32_t> leafOf;   // 物体id -> 所在叶子, update()用
+    CenterExtentSoA leafBoxes; // 叶子测试用, 按primIdx的顺序
+    vector<uint32_t> posOf;    // 物体id -> 在primIdx/leafBoxes里的位置
+    uint32_t placed = 0;       // primIdx里前placed个在树里, 后面是build时empty的
+    int parkedLive = 0;        // 后面那段里现在不是empty的个数
+    float builtCost = 0;
+
+    future<unique_ptr<BVH>> pending;  // 后台rebuild
+};
+
+//=========================================================
+// test
+
+// 暴力裁剪做参考
+vector<uint32_t> cullBruteForce(const vector<AABB>& boxes, const Frustum& fr) {
+    vector<uint32_t> out;
+    for (uint32_t i = 0; i < boxes.size(); ++i) {
+        if (aabbInsideFrustum(boxes[i], fr)) out.push_back(i);
+    }
+    return out;
+}
+
+float rnd(float lo, float hi) {
+    return lo + (hi - lo) * rand() / RAND_MAX;
+}
+
+// GIS的例子: World下面直接挂5000个POI, 逻辑层次帮不上忙.
+void subtest1() {
+    cout << __FUNCTION__ << endl;
+
+    srand(41);
+    const uint32_t n = 5000;
+    vector<AABB> boxes(n);
+    for (auto& b : boxes) {
+        vec3 c(rnd(-1000, 1000), rnd(-1000, 1000), rnd(0, 10));
+        b = AABB::fromCenterExtent(c, {rnd(1, 5), rnd(1, 5), rnd(1, 5)});
+    }
+
+    BVH bvh;
+    bvh.build(boxes);
+    cout << "nodes: " << bvh.nodeCount() << endl;
+
+    // 一个看市中心的小视锥
+    Frustum fr = Frustum::fromBox(AABB::fromMinMax({-100, -100, -10}, {100, 100, 20}));
+    vector<uint32_t> visible;
+    size_t tests = 0;
+    bvh.cull(fr, visible, &tests);
+    sort(visible.begin(), visible.end());
+    auto ref = cullBruteForce(boxes, fr);
+    assert(visible == ref);
+    cout << "visible: " << visible.size() << ", bvh tests: " << tests << ", brute force tests: " << n << endl;
+    assert(tests < n / 10);
+
+    // 什么都看不到
+    visible.clear();
+    bvh.cull(Frustum::fromBox(AABB::fromMinMax({5000, 5000, 0}, {6000, 6000, 10})), visible, &tests);
+    assert(visible.empty() && tests == 1);
+}
+
+// 物体移动: refit保证正确, 质量下降后后台rebuild.
+void subtest2() {
+    cout << __FUNCTION__ << endl;
+
+    srand(41);
+    const uint32_t n = 2000;
+    vector<AABB> boxes(n);
+    for (auto& b : boxes) {
+        vec3 c(rnd(-1000, 1000), rnd(-1000, 1000), rnd(0, 10));
+        b = AABB::fromCenterExtent(c, {2, 2, 2});
+    }
+    BVH bvh;
+    bvh.build(boxes);
+    float cost0 = bvh.sahCost();
+
+    Frustum fr = Frustum::fromBox(AABB::fromMinMax({-200, -200, -10}, {200, 200, 20}));
+    auto check = [&] {
+        vector<uint32_t> visible;
+        bvh.cull(fr, visible);
+        sort(visible.begin(), visible.end());
+        assert(visible == cullBruteForce(boxes, fr));
+    };
+
+    // 小幅移动, refit就够了, 不触发rebuild
+    for (uint32_t i = 0; i < n; i += 10) {
+        boxes[i] = boxes[i].translated({rnd(-1, 1), rnd(-1, 1), 0});
+        bvh.update(i, boxes[i]);
+    }
+    check();
+    bvh.maintain();
+    assert(!bvh.rebuilding());
+
+    // 很多物体跳到地图另一边, 包围盒变得很大, 质量下降
+    for (uint32_t i = 0; i < n; i += 4) {
+        boxes[i] = AABB::fromCenterExtent({rnd(-1000, 1000), rnd(-1000, 1000), rnd(0, 10)}, {2, 2, 2});
+        bvh.update(i, boxes[i]);
+    }
+    check();
+    float costMoved = bvh.sahCost();
+    cout << "sah cost: built " << cost0 << ", after moves " << costMoved << endl;
+    assert(costMoved > cost0 * BVH::REBUILD_RATIO);
+
+    bvh.maintain();  // 启动后台rebuild
+    assert(bvh.rebuilding());
+    // rebuild期间继续移动, 换进来的时候要refit追上
+    boxes[1] = AABB::fromCenterExtent({0, 0, 0}, {2, 2, 2});
+    bvh.update(1, boxes[1]);
+    check();
+
+    bvh.maintain(true);  // 等后台rebuild完成并换进来
+    assert(!bvh.rebuilding());
+    check();
+    cout << "sah cost after rebuild: " << bvh.sahCost() << endl;
+    assert(bvh.sahCost() < costMoved);
+}
+
+// SIMD批量裁剪, 平铺的物体列表直接用, 结果和逐个aabbInsideFrustum一样.
+void subtest3() {
+    cout << __FUNCTION__ << endl;
+
+    srand(41);
+    // 故意不是8的倍数, 中间放一些empty的box
+    const uint32_t n = 1003;
+    vector<AABB> boxes(n);
+    CenterExtentSoA soa;
+    for (uint32_t i = 0; i < n; ++i) {
+        if (i % 17 == 0) {
+            boxes[i] = AABB::empty();
+        } else {
+            vec3 c(rnd(-100, 100), rnd(-100, 100), rnd(-100, 100));
+            boxes[i] = AABB::fromCenterExtent(c, {rnd(0, 5), rnd(0, 5), rnd(0, 5)});
+        }
+        soa.push_back(boxes[i]);
+    }
+
+    // 一个斜着的视锥, 法线不是轴对齐的
+    Frustum fr = Frustum::fromBox(AABB::fromMinMax({-50, -50, -50}, {50, 50, 50}));
+    fr.planes[0].n = normalize(vec3(1, 1, 0));
+    fr.planes[0].d = 10;
+
+    vector<uint32_t> ref = cullBruteForce(boxes, fr);
+
+    vector<uint32_t> visible;
+    cullAABBs(soa, fr, visible);
+    assert(visible == ref);
+
+    // 子区间
+    visible.clear();
+    cullAABBs(soa, 5, 30, fr, visible);
+    vector<uint32_t> refRange;
+    for (auto i : ref)
+        if (i >= 5 && i < 30) refRange.push_back(i);
+    assert(visible == refRange);
+
+    // bitmask
+    vector<uint8_t> mask;
+    cullAABBsMask(soa, fr, mask);
+    size_t cnt = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        bool vis = mask[i / 8] & (1u << (i % 8));
+        assert(vis == aabbInsideFrustum(boxes[i], fr));
+        cnt += vis;
+    }
+    cout << "visible: " << cnt << " / " << n << endl;
+    assert(cnt == ref.size());
+}
+
+// 没有几何的物体 (empty AABB): 建树, update成empty, 再rebuild都不会越界, 结果和暴力裁剪一样.
+void subtest4() {
+    cout << __FUNCTION__ << endl;
+
+    srand(41);
+    const uint32_t n = 1000;
+    vector<AABB> boxes(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        if (i % 7 == 0) {
+            boxes[i] = AABB::empty();
+        } else {
+            vec3 c(rnd(-500, 500), rnd(-500, 500), rnd(0, 10));
+            boxes[i] = AABB::fromCenterExtent(c, {2, 2, 2});
+        }
+    }
+    BVH bvh;
+    bvh.build(boxes);
+
+    Frustum fr = Frustum::fromBox(AABB::fromMinMax({-200, -200, -10}, {200, 200, 20}));
+    auto check = [&] {
+        vector<uint32_t> visible;
+        bvh.cull(fr, visible);
+        sort(visible.begin(), visible.end());
+        assert(visible == cullBruteForce(boxes, fr));
+    };
+    check();
+    cout << "nodes: " << bvh.nodeCount() << endl;
+
+    // 树里的物体变成empty
+    for (uint32_t i = 1; i < n; i += 5) {
+        boxes[i] = AABB::empty();
+        bvh.update(i, boxes[i]);
+    }
+    check();
+    // 建树时empty的物体有了bounds, rebuild之前也能裁剪到
+    boxes[0] = AABB::fromCenterExtent({0, 0, 0}, {2, 2, 2});
+    bvh.update(0, boxes[0]);
+    check();
+    bvh.maintain(true);  // 要把它放进树里, 触发rebuild
+    assert(!bvh.rebuilding());
+    check();
+    // rebuild以后, 再全部变成empty, 再rebuild
+    for (uint32_t i = 0; i < n; ++i) {
+        boxes[i] = AABB::empty();
+        bvh.update(i, boxes[i]);
+    }
+    check();
+    bvh.build(boxes);
+    assert(bvh.nodeCount() == 0);
+    check();
+    boxes[3] = AABB::fromCenterExtent({0, 0, 0}, {1, 1, 1});
+    bvh.update(3, boxes[3]);
+    check();
+    bvh.maintain(true);
+    check();
+    cout << "nodes after rebuild: " << bvh.nodeCount() << endl;
+}
+
+int cppMain() {
+    subtest1();
+    subtest2();
+    subtest3();
+    subtest4();
+
+    cout << "cppMain done." << endl;
+    return 0;
+}
+
+}  // namespace gfx_bvh
+/*===== Output =====
+
+[RUN  ] gfx_bvh
+subtest1
+nodes: 2439
+visible: 46, bvh tests: 149, brute force tests: 5000
+subtest2
+sah cost: built 8.97709, after moves 275.869
+sah cost after rebuild: 9.64725
+subtest3
+visible: 92 / 1003
+subtest4
+nodes: 475
+nodes after rebuild: 1
+cppMain done.
+[   OK] gfx_bvh
+
+*/
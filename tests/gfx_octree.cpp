@@ -0,0 +1,568 @@
+#include <assert.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>  // rand
+#include <iostream>
+#include <limits>
+#include <vector>
+using namespace std;
+
+#include "aabb.h"
+#include "mat4.h"
+#include "vec3.h"
+
+namespace gfx_octree {
+
+//=========================================================
+// gfx_octree
+/*
+3D 场景的空间索引: 拾取 (ray cast) 和邻近查询 (box / sphere), 以及视锥查询.
+gfx_quad_tree 是 2D 的而且用 glm, 这里用 vec3.h 和 aabb.h 里的 AABB / Frustum, 和 gfx_tree / gfx_bvh 共用.
+
+结构是 gfx_quad_tree 里 LooseQuadTree 的 3D 版 (loose octree):
+    node 的 "松" 边界 = 格子向四周各扩半个格子.
+    物体尺寸 <= 格子尺寸时, 中心在格子里物体就一定在松边界里,
+    所以层级由尺寸直接算出 (frexp), 格子由中心算出, 每个物体只存一份, 移动时多数情况原地更新.
+    中心在 world 外的物体挂在 root, root 不按边界剪枝.
+    点就是大小为 0 的 AABB, 会落在最深层.
+
+和 gfx_bvh 的区别:
+    BVH 按物体分组, 建一次要 O(n log n), 物体动了靠 refit, 质量会变差.
+    octree 按空间分格子, 插入/删除/移动都是局部的, 适合大量物体一直在动的场景.
+
+查询:
+    box / sphere: 松边界和查询范围不相交就跳过整个子树.
+    frustum: 和 gfx_tree 的 cullAndDraw_masked 一样继承平面 mask, 子树整个在视锥里面时, 不再测, 直接全收.
+    ray: slab 法求进入距离 t, 孩子按 t 从近到远访问, t 比当前最近的命中还远就剪掉.
+*/
+
+struct Sphere {
+    vec3 center;
+    float r;
+};
+
+// 射线: origin + t * dir, t >= 0. dir 不要求单位长度, t 的单位跟着 dir 走.
+struct Ray {
+    vec3 origin, dir;
+};
+
+inline float axisOf(const vec3& v, int axis) {
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+inline bool overlaps(const AABB& a, const AABB& b) {
+    return !(a.max.x < b.min.x || a.min.x > b.max.x ||
+             a.max.y < b.min.y || a.min.y > b.max.y ||
+             a.max.z < b.min.z || a.min.z > b.max.z);
+}
+
+inline bool containsPoint(const AABB& b, const vec3& p) {
+    return p.x >= b.min.x && p.x <= b.max.x &&
+           p.y >= b.min.y && p.y <= b.max.y &&
+           p.z >= b.min.z && p.z <= b.max.z;
+}
+
+// 球心到盒子的最近距离 <= r
+inline bool overlaps(const AABB& b, const Sphere& s) {
+    float d2 = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+        float c = axisOf(s.center, axis);
+        float v = std::clamp(c, axisOf(b.min, axis), axisOf(b.max, axis)) - c;
+        d2 += v * v;
+    }
+    return d2 <= s.r * s.r;
+}
+
+// slab 法: 每个轴算出射线进出这两个平面的 t, 取进入的最大值和离开的最小值.
+// dir 某个分量为 0 时不能除, 单独判断 origin 是否在这个 slab 里.
+// 命中返回 true, tEnter 是进入距离 (origin 在盒子里为 0).
+inline bool intersectRay(const AABB& b, const Ray& ray, float tMax, float& tEnter) {
+    float t0 = 0, t1 = tMax;
+    for (int axis = 0; axis < 3; ++axis) {
+        float o = axisOf(ray.origin, axis), d = axisOf(ray.dir, axis);
+        float lo = axisOf(b.min, axis), hi = axisOf(b.max, axis);
+        if (d == 0) {
+            if (o < lo || o > hi) return false;
+            continue;
+        }
+        float inv = 1.0f / d;
+        float tNear = (lo - o) * inv, tFar = (hi - o) * inv;
+        if (tNear > tFar) swap(tNear, tFar);
+        t0 = max(t0, tNear);
+        t1 = min(t1, tFar);
+        if (t0 > t1) return false;
+    }
+    tEnter = t0;
+    return true;
+}
+
+struct RayHit {
+    uint32_t handle = UINT32_MAX;
+    float t = numeric_limits<float>::infinity();
+};
+
+class Octree {
+public:
+    using Handle = uint32_t;
+
+    explicit Octree(const AABB& world, int maxDepth = 8) : world(world), worldSize(world.max - world.min), maxDepth(maxDepth) {
+        assert(maxDepth >= 0 && maxDepth < 21);  // 遍历用的固定大小栈按 20 层算
+        nodes.emplace_back();
+    }
+
+    Handle insert(const AABB& box) {
+        Handle h;
+        if (!freeHandles.empty()) {
+            h = freeHandles.back();
+            freeHandles.pop_back();
+        } else {
+            h = (Handle)entries.size();
+            entries.emplace_back();
+        }
+        entries[h].box = box;
+        entries[h].alive = true;
+        link(h, locate(box));
+        ++alive;
+        return h;
+    }
+
+    // 删掉后 handle 会被复用, 不要再用
+    void remove(Handle h) {
+        assert(h < entries.size() && entries[h].alive);
+        unlink(h);
+        entries[h].alive = false;
+        freeHandles.push_back(h);
+        --alive;
+    }
+
+    // 还在同一个 node 里就只改 box, 否则从旧 node 摘下挂到新 node
+    // true - 原地更新
+    bool update(Handle h, const AABB& box) {
+        assert(h < entries.size() && entries[h].alive);
+        Location loc = locate(box);
+        Entry& e = entries[h];
+        e.box = box;
+        const Node& n = nodes[e.node];
+        if (n.level == loc.level && n.cx == loc.cx && n.cy == loc.cy && n.cz == loc.cz) return true;
+        unlink(h);
+        link(h, loc);
+        return false;
+    }
+
+    const AABB& bounds(Handle h) const { return entries[h].box; }
+    int levelOf(Handle h) const { return nodes[entries[h].node].level; }
+    size_t size() const { return alive; }
+    size_t nodeCount() const { return nodes.size() - freeNodes.size(); }
+
+    void query(const AABB& range, vector<Handle>& out) const {
+        visit([&](const AABB& b) { return overlaps(b, range); }, out);
+    }
+
+    void query(const Sphere& s, vector<Handle>& out) const {
+        visit([&](const AABB& b) { return overlaps(b, s); }, out);
+    }
+
+    // 保守测试, 和 aabbInsideFrustum 结果一样
+    // planeTests: 可选, 累加做了几次平面测试
+    void query(const Frustum& f, vector<Handle>& out, size_t* planeTests = nullptr) const {
+        int lastReject = -1;
+        // root 的物体可能在 world 外, 用全部平面逐个测
+        for (Handle h : nodes[0].items)
+            if (cullPlanes(entries[h].box, f, CULL_ALL_PLANES, lastReject, planeTests) != CULL_OUTSIDE) out.push_back(h);
+        for (int c = 0; c < 8; ++c)
+            if (nodes[0].child[c] >= 0) visitFrustum((uint32_t)nodes[0].child[c], f, CULL_ALL_PLANES, lastReject, out, planeTests);
+    }
+
+    // 最近的命中 (射线和物体 AABB 相交), 没有返回 false
+    bool raycast(const Ray& ray, RayHit& hit, float tMax = numeric_limits<float>::infinity()) const {
+        hit = RayHit{};
+        hit.t = tMax;
+        raycastNode(0, ray, hit);
+        return hit.handle != UINT32_MAX;
+    }
+
+private:
+    struct Node {
+        int child[8] = {-1, -1, -1, -1, -1, -1, -1, -1};
+        int level = 0;
+        uint32_t cx = 0, cy = 0, cz = 0;  // level 层的格子坐标
+        uint32_t parent = 0;
+        int count = 0;                    // 子树里的物体数, 查询时跳过空子树
+        vector<Handle> items;
+    };
+    struct Entry {
+        AABB box{};
+        uint32_t node = 0;
+        uint32_t slot = 0;  // 在 node.items 里的下标, 删除时 O(1)
+        bool alive = false;
+    };
+    struct Location {
+        int level;
+        uint32_t cx, cy, cz;
+    };
+
+    AABB world;
+    vec3 worldSize;
+    int maxDepth;
+    vector<Node> nodes;
+    vector<Entry> entries;
+    vector<Handle> freeHandles;
+    vector<uint32_t> freeNodes;  // 空了摘掉的 node, link 的时候复用
+    size_t alive = 0;
+
+    vec3 cellSize(int level) const { return worldSize * (1.0f / float(1u << level)); }
+
+    AABB looseBounds(const Node& n) const {
+        vec3 cs = cellSize(n.level);
+        vec3 cellMin = world.min + vec3(float(n.cx) * cs.x, float(n.cy) * cs.y, float(n.cz) * cs.z);
+        return {cellMin - cs * 0.5f, cellMin + cs * 1.5f};
+    }
+
+    // 满足 extent <= size / 2^L 的最大 L
+    int levelForExtent(float extent, float size) const {
+        if (!(extent > 0.0f)) return maxDepth;
+        int e;
+        frexp(size / extent, &e);  // size/extent = m * 2^e, m in [0.5, 1)
+        return std::clamp(e - 1, 0, maxDepth);
+    }
+
+    Location locate(const AABB& b) const {
+        vec3 center = b.center();
+        if (!containsPoint(world, center)) return {0, 0, 0, 0};
+        vec3 extent = b.max - b.min;
+        int level = min({levelForExtent(extent.x, worldSize.x), levelForExtent(extent.y, worldSize.y),
+                         levelForExtent(extent.z, worldSize.z)});
+        // 浮点舍入可能差一点点, 用查询时同样的松边界验证, 不满足就往上一层
+        for (;; --level) {
+            uint32_t n = 1u << level;
+            vec3 cs = cellSize(level);
+            Node probe;
+            probe.level = level;
+            probe.cx = min(n - 1, (uint32_t)((center.x - world.min.x) / cs.x));
+            probe.cy = min(n - 1, (uint32_t)((center.y - world.min.y) / cs.y));
+            probe.cz = min(n - 1, (uint32_t)((center.z - world.min.z) / cs.z));
+            AABB loose = looseBounds(probe);
+            if (level == 0 || (containsPoint(loose, b.min) && containsPoint(loose, b.max)))
+                return {level, probe.cx, probe.cy, probe.cz};
+        }
+    }
+
+    // 从 root 按格子坐标的位往下走, 缺的 node 现建
+    void link(Handle h, const Location& loc) {
+        uint32_t idx = 0;
+        ++nodes[0].count;
+        for (int l = 1; l <= loc.level; ++l) {
+            int shift = loc.level - l;
+            int c = (int)(((loc.cx >> shift) & 1) | (((loc.cy >> shift) & 1) << 1) | (((loc.cz >> shift) & 1) << 2));
+            if (nodes[idx].child[c] < 0) {
+                Node child;
+                child.level = l;
+                child.cx = loc.cx >> shift;
+                child.cy = loc.cy >> shift;
+                child.cz = loc.cz >> shift;
+                child.parent = idx;
+                uint32_t ci;
+                if (!freeNodes.empty()) {
+                    ci = freeNodes.back();
+                    freeNodes.pop_back();
+                    nodes[ci] = std::move(child);
+                } else {
+                    ci = (uint32_t)nodes.size();
+                    nodes.push_back(std::move(child));
+                }
+                nodes[idx].child[c] = (int)ci;
+            }
+            idx = (uint32_t)nodes[idx].child[c];
+            ++nodes[idx].count;
+        }
+        Entry& e = entries[h];
+        e.node = idx;
+        e.slot = (uint32_t)nodes[idx].items.size();
+        nodes[idx].items.push_back(h);
+    }
+
+    void unlink(Handle h) {
+        Entry& e = entries[h];
+        auto& items = nodes[e.node].items;
+        Handle last = items.back();
+        items[e.slot] = last;
+        entries[last].slot = e.slot;
+        items.pop_back();
+        // 子树里没有物体的 node 从父节点摘掉回收, 物体一直在动 node 数也不会越来越多.
+        // 空了的 node 不会有孩子 (孩子不空的话计数不会是 0), 摘下的总是路径上从下往上的一段.
+        for (uint32_t idx = e.node;; idx = nodes[idx].parent) {
+            if (--nodes[idx].count == 0 && idx != 0) {
+                Node& parent = nodes[nodes[idx].parent];
+                for (int& c : parent.child)
+                    if (c == (int)idx) c = -1;
+                vector<Handle>().swap(nodes[idx].items);
+                freeNodes.push_back(idx);
+            }
+            if (idx == 0) break;
+        }
+    }
+
+    // hit(AABB): 物体/松边界是否和查询范围相交
+    template <class Hit>
+    void visit(const Hit& hit, vector<Handle>& out) const {
+        uint32_t stack[7 * 21 + 8];
+        int top = 0;
+        stack[top++] = 0;
+        while (top) {
+            const Node& n = nodes[stack[--top]];
+            // root 不按松边界剪枝: world 外的物体也挂在 root
+            if (n.count == 0 || (n.level > 0 && !hit(looseBounds(n)))) continue;
+            for (Handle h : n.items)
+                if (hit(entries[h].box)) out.push_back(h);
+            for (int c = 7; c >= 0; --c)
+                if (n.child[c] >= 0) stack[top++] = (uint32_t)n.child[c];
+        }
+    }
+
+    // 子树整个在视锥里面
+    void acceptSubtree(const Node& n, vector<Handle>& out) const {
+        out.insert(out.end(), n.items.begin(), n.items.end());
+        for (int c = 0; c < 8; ++c)
+            if (n.child[c] >= 0 && nodes[n.child[c]].count) acceptSubtree(nodes[n.child[c]], out);
+    }
+
+    void visitFrustum(uint32_t idx, const Frustum& f, uint32_t mask, int& lastReject, vector<Handle>& out, size_t* planeTests) const {
+        const Node& n = nodes[idx];
+        if (n.count == 0) return;
+        mask = cullPlanes(looseBounds(n), f, mask, lastReject, planeTests);
+        if (mask == CULL_OUTSIDE) return;
+        if (mask == 0) {
+            acceptSubtree(n, out);
+            return;
+        }
+        for (Handle h : n.items)
+            if (cullPlanes(entries[h].box, f, mask, lastReject, planeTests) != CULL_OUTSIDE) out.push_back(h);
+        for (int c = 0; c < 8; ++c)
+            if (n.child[c] >= 0) visitFrustum((uint32_t)n.child[c], f, mask, lastReject, out, planeTests);
+    }
+
+    void raycastNode(uint32_t idx, const Ray& ray, RayHit& hit) const {
+        const Node& n = nodes[idx];
+        float t;
+        if (n.count == 0 || (n.level > 0 && !intersectRay(looseBounds(n), ray, hit.t, t))) return;
+        for (Handle h : n.items) {
+            // 同样的 t 取 handle 小的, 结果不依赖遍历顺序
+            if (intersectRay(entries[h].box, ray, hit.t, t) && (t < hit.t || (t == hit.t && h < hit.handle))) {
+                hit.t = t;
+                hit.handle = h;
+            }
+        }
+        // 孩子按进入距离从近到远, 比当前最近命中还远的不用看
+        pair<float, uint32_t> order[8];
+        int cnt = 0;
+        for (int c = 0; c < 8; ++c) {
+            if (n.child[c] < 0 || nodes[n.child[c]].count == 0) continue;
+            if (intersectRay(looseBounds(nodes[n.child[c]]), ray, hit.t, t)) order[cnt++] = {t, (uint32_t)n.child[c]};
+        }
+        sort(order, order + cnt);
+        for (int i = 0; i < cnt && order[i].first <= hit.t; ++i) raycastNode(order[i].second, ray, hit);
+    }
+};
+
+//=========================================================
+// tests
+
+float frand(float lo, float hi) { return lo + rand() / (float)RAND_MAX * (hi - lo); }
+
+// 大小从 0 (点) 到 40 的盒子, 有一部分中心在 world 外
+AABB randomBox() {
+    vec3 c{frand(-110, 110), frand(-110, 110), frand(-110, 110)};
+    float size = rand() % 10 == 0 ? 0.0f : pow(10.0f, frand(-2.0f, 1.3f));
+    return AABB::fromCenterExtent(c, vec3(size, size * 0.5f, size * 0.25f));
+}
+
+// box / sphere 查询和暴力一致, 移动 / 删除后仍一致
+void subtest1() {
+    cout << __FUNCTION__ << endl;
+
+    srand(51);
+    AABB world{vec3(-100), vec3(100)};
+    Octree tree(world);
+    vector<uint32_t> handles;
+    for (int i = 0; i < 5000; ++i) handles.push_back(tree.insert(randomBox()));
+
+    auto check = [&](const auto& range) {
+        vector<uint32_t> got, expect;
+        tree.query(range, got);
+        for (uint32_t h : handles)
+            if (overlaps(tree.bounds(h), range)) expect.push_back(h);
+        sort(got.begin(), got.end());
+        sort(expect.begin(), expect.end());
+        assert(got == expect);
+        return got.size();
+    };
+    auto checkAll = [&] {
+        size_t hits = 0;
+        for (int q = 0; q < 100; ++q) {
+            vec3 c{frand(-120, 120), frand(-120, 120), frand(-120, 120)};
+            float r = frand(0.5f, 30);
+            hits += check(AABB::fromCenterExtent(c, vec3(r))) + check(Sphere{c, r});
+        }
+        return hits;
+    };
+    size_t hits = checkAll();
+
+    size_t inPlace = 0;
+    for (int frame = 0; frame < 10; ++frame)
+        for (uint32_t h : handles) inPlace += tree.update(h, tree.bounds(h).translated(vec3(frand(-0.1f, 0.1f), frand(-0.1f, 0.1f), 0)));
+    hits += checkAll();
+    assert(inPlace * 4 > handles.size() * 10 * 3);
+
+    vector<uint32_t> kept;
+    for (size_t i = 0; i < handles.size(); ++i) {
+        if (i % 3 == 0)
+            tree.remove(handles[i]);
+        else
+            kept.push_back(handles[i]);
+    }
+    handles.swap(kept);
+    assert(tree.size() == handles.size());
+    hits += checkAll();
+
+    cout << "objects " << tree.size() << ", nodes " << tree.nodeCount() << ", hits " << hits << ", in-place updates "
+         << inPlace << "/" << 10 * 5000 << endl;
+}
+
+// 视锥查询: 和逐个 aabbInsideFrustum 一致, 平面测试次数少很多
+void subtest2() {
+    cout << __FUNCTION__ << endl;
+
+    srand(52);
+    AABB world{vec3(-100), vec3(100)};
+    Octree tree(world);
+    vector<AABB> boxes;
+    for (int i = 0; i < 20000; ++i) {
+        boxes.push_back(randomBox());
+        tree.insert(boxes.back());
+    }
+
+    Frustum f = Frustum::fromMatrix(perspective(60.0f * 3.14159265f / 180.0f, 16.0f / 9, 0.1f, 120.0f) *
+                                    lookAt({0, 10, 90}, {10, 0, 0}, {0, 1, 0}));
+    vector<uint32_t> got, expect;
+    size_t tests = 0;
+    tree.query(f, got, &tests);
+    for (uint32_t h = 0; h < boxes.size(); ++h)
+        if (aabbInsideFrustum(boxes[h], f)) expect.push_back(h);
+    sort(got.begin(), got.end());
+    assert(got == expect);
+    cout << "visible " << got.size() << " / " << boxes.size() << ", plane tests " << tests << " (brute force " << boxes.size() * 6
+         << ")" << endl;
+    assert(tests < boxes.size() * 6 / 2);
+}
+
+// 拾取: 最近命中和暴力一致
+void subtest3() {
+    cout << __FUNCTION__ << endl;
+
+    srand(53);
+    AABB world{vec3(-100), vec3(100)};
+    Octree tree(world);
+    vector<uint32_t> handles;
+    for (int i = 0; i < 5000; ++i) handles.push_back(tree.insert(randomBox()));
+
+    int hitCount = 0;
+    for (int q = 0; q < 300; ++q) {
+        vec3 origin{frand(-150, 150), frand(-150, 150), frand(-150, 150)};
+        vec3 target{frand(-50, 50), frand(-50, 50), frand(-50, 50)};
+        // 每10条里有一条轴对齐的射线, 走 dir 分量为 0 的分支
+        Ray ray{origin, q % 10 == 0 ? vec3(0, 0, origin.z > 0 ? -1.0f : 1.0f) : normalize(target - origin)};
+
+        RayHit expect;
+        for (uint32_t h : handles) {
+            float t;
+            if (intersectRay(tree.bounds(h), ray, expect.t, t) && (t < expect.t || (t == expect.t && h < expect.handle))) {
+                expect.t = t;
+                expect.handle = h;
+            }
+        }
+        RayHit hit;
+        bool found = tree.raycast(ray, hit);
+        assert(found == (expect.handle != UINT32_MAX));
+        assert(hit.handle == expect.handle && (!found || hit.t == expect.t));
+        hitCount += found;
+
+        // 限制距离
+        RayHit nearHit;
+        tree.raycast(ray, nearHit, 10.0f);
+        assert(nearHit.handle == (expect.t <= 10.0f ? expect.handle : UINT32_MAX));
+    }
+    // 删掉命中的物体, 下一次拾取到后面的
+    Ray ray{vec3(0, 0, 150), vec3(0, 0, -1)};
+    RayHit first, second;
+    if (tree.raycast(ray, first)) {
+        tree.remove(first.handle);
+        if (tree.raycast(ray, second)) assert(second.t >= first.t && second.handle != first.handle);
+    }
+    cout << "rays hit " << hitCount << " / 300" << endl;
+}
+
+// 物体长时间乱走: 空了的 node 回收, node 数不会一直涨
+void subtest4() {
+    cout << __FUNCTION__ << endl;
+
+    srand(54);
+    const int maxDepth = 8;
+    AABB world{vec3(-100), vec3(100)};
+    Octree tree(world, maxDepth);
+    vector<uint32_t> handles;
+    vector<vec3> pos;
+    for (int i = 0; i < 500; ++i) {
+        pos.push_back({frand(-100, 100), frand(-100, 100), frand(-100, 100)});
+        handles.push_back(tree.insert(AABB{pos.back(), pos.back()}));  // 点, 在最深层
+    }
+    // 每个物体最多占一条 maxDepth 长的路径
+    const size_t bound = handles.size() * maxDepth + 1;
+    size_t peak = 0;
+    for (int frame = 0; frame < 400; ++frame) {
+        for (size_t i = 0; i < handles.size(); ++i) {
+            pos[i] = pos[i] + vec3(frand(-2, 2), frand(-2, 2), frand(-2, 2));
+            for (int axis = 0; axis < 3; ++axis) {
+                float& v = axis == 0 ? pos[i].x : (axis == 1 ? pos[i].y : pos[i].z);
+                v = std::clamp(v, -100.0f, 100.0f);
+            }
+            tree.update(handles[i], AABB{pos[i], pos[i]});
+        }
+        peak = max(peak, tree.nodeCount());
+        assert(tree.nodeCount() <= bound);
+    }
+    vector<uint32_t> got;
+    tree.query(world, got);
+    assert(got.size() == handles.size());
+
+    for (uint32_t h : handles) tree.remove(h);
+    assert(tree.nodeCount() == 1);
+    cout << "objects " << handles.size() << ", peak nodes " << peak << " (bound " << bound << ")" << endl;
+}
+
+int cppMain() {
+    subtest1();
+    subtest2();
+    subtest3();
+    subtest4();
+
+    return 0;
+}
+
+}  // namespace gfx_octree
+/*===== Output =====
+
+[RUN  ] gfx_octree
+subtest1
+objects 3333, nodes 8770, hits 9141, in-place updates 46914/50000
+subtest2
+visible 2807 / 20000, plane tests 31493 (brute force 120000)
+subtest3
+rays hit 279 / 300
+subtest4
+objects 500, peak nodes 2883 (bound 4001)
+[tid=1] [Memory Report] globalNewCnt = 228771, globalDeleteCnt = 228771, globalNewMemSize = 33138852, globalDeleteMemSize = 33138852
+[   OK] gfx_octree
+
+*/
@@ -1,3 +1,4 @@
+#include <assert.h>
 #include <iostream>
 using namespace std;
 
@@ -5,12 +6,23 @@ using namespace std;
 using namespace glm;
 
 #include <algorithm>
+#include <array>
+#include <chrono>
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>  // rand
+#include <limits>
 // #include <ctime>    // time
 #include <memory>
+#include <queue>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 namespace gfx_quad_tree {
 
 //=========================================================
@@ -106,6 +118,11 @@ struct AABB {
         return !(max.x < other.min.x || min.x > other.max.x ||
                  max.y < other.min.y || min.y > other.max.y);
     }
+    // p 到盒子的最近距离的平方, p 在盒子里为 0
+    float distance2(const vec2& p) const {
+        vec2 d = p - glm::clamp(p, min, max);
+        return dot(d, d);
+    }
 };
 
 struct Circle {
@@ -132,89 +149,924 @@ struct Circle {
     }
 };
 
-// 每个叶子node最多3个点, 超过了就分裂
-#define CAPACITY 3
-// #define MAX_DEPTH 10
+//=========================================================
+// 叶子里的点: SoA
+/*
+vector<vec2> 是 xyxyxy..., 一次测一个点. 改成 x 和 y 各一个 vector<float>, 长度补齐到 8 的倍数, 每 8 个点算一块:
+    一次 loadu 8 个 x / 8 个 y, AVX2 比较得到 8bit 的 mask,
+    再用 compress-store (和 aabb.h 里 compressTable 一样的表) 把命中的点挤到前面, 交错回 vec2 写到 out 末尾.
+叶子越大 SIMD 越划算, 可以把 Capacity 调大 (比如 32/64), 树更浅, 少很多 node.
+块里超过 size 的 lane 是垃圾数据, 用 mask 去掉.
+不用 alignas(32) 的块: vector 里放过对齐类型会走 aligned operator new, MemoryTracker 统计不到, 叶子就漏出了泄漏检查.
+普通 vector<float> 走被跟踪的 operator new, 地址不保证 32 字节对齐, 所以用 loadu (现在的 CPU 上没对齐的 load 不跨 cache line 时没有额外开销).
+标量版本的比较和 AABB::contains / Circle::contains 一样 (dx*dx + dy*dy, 没有FMA), 两边结果一致.
+*/
+static_assert(sizeof(vec2) == 2 * sizeof(float), "compress-store writes vec2 as packed float pairs");
+
+#ifdef __AVX2__
+// mask -> 把置位的lane挪到前面的permute下标
+inline const __m256i* compressTable8() {
+    alignas(32) static int32_t table[256][8];
+    static bool init = [] {
+        for (int m = 0; m < 256; ++m) {
+            int k = 0;
+            for (int lane = 0; lane < 8; ++lane)
+                if (m & (1 << lane)) table[m][k++] = lane;
+            while (k < 8) table[m][k++] = 0;
+        }
+        return true;
+    }();
+    (void)init;
+    return reinterpret_cast<const __m256i*>(table);
+}
+#endif
+
+class LeafPoints {
+    // 长度总是 8 的倍数, 第 b 块是 [b*8, b*8+8)
+    vector<float> xs, ys;
+    int n = 0;
+
+    int blockCount() const { return (int)xs.size() >> 3; }
+
+    // 块 b 里在 range 内的 lane
+    uint32_t blockMask(int b, const AABB& r) const {
+        uint32_t mask = 0;
+#ifdef __AVX2__
+        __m256 x = _mm256_loadu_ps(&xs[b * 8]), y = _mm256_loadu_ps(&ys[b * 8]);
+        __m256 in = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(x, _mm256_set1_ps(r.min.x), _CMP_GE_OQ),
+                                                _mm256_cmp_ps(x, _mm256_set1_ps(r.max.x), _CMP_LE_OQ)),
+                                  _mm256_and_ps(_mm256_cmp_ps(y, _mm256_set1_ps(r.min.y), _CMP_GE_OQ),
+                                                _mm256_cmp_ps(y, _mm256_set1_ps(r.max.y), _CMP_LE_OQ)));
+        mask = (uint32_t)_mm256_movemask_ps(in);
+#else
+        for (int lane = 0; lane < 8; ++lane)
+            if (r.contains(vec2(xs[b * 8 + lane], ys[b * 8 + lane]))) mask |= 1u << lane;
+#endif
+        return mask & laneMask(b);
+    }
+
+    uint32_t blockMask(int b, const Circle& c) const {
+        uint32_t mask = 0;
+#ifdef __AVX2__
+        __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(&xs[b * 8]), _mm256_set1_ps(c.center.x));
+        __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(&ys[b * 8]), _mm256_set1_ps(c.center.y));
+        __m256 d2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        mask = (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(d2, _mm256_set1_ps(c.r * c.r), _CMP_LE_OQ));
+#else
+        for (int lane = 0; lane < 8; ++lane)
+            if (c.contains(vec2(xs[b * 8 + lane], ys[b * 8 + lane]))) mask |= 1u << lane;
+#endif
+        return mask & laneMask(b);
+    }
+
+    // 最后一块只有 n % 8 个有效 lane
+    uint32_t laneMask(int b) const {
+        int valid = n - b * 8;
+        return valid >= 8 ? 0xffu : (1u << valid) - 1;
+    }
+
+public:
+    // 按值返回 vec2 的只读迭代器, for (const vec2& p : pts) 可以照常用
+    class const_iterator {
+        const LeafPoints* owner;
+        int i;
+
+    public:
+        const_iterator(const LeafPoints* owner, int i) : owner(owner), i(i) {}
+        vec2 operator*() const { return (*owner)[i]; }
+        const_iterator& operator++() {
+            ++i;
+            return *this;
+        }
+        bool operator!=(const const_iterator& o) const { return i != o.i; }
+    };
+    const_iterator begin() const { return {this, 0}; }
+    const_iterator end() const { return {this, n}; }
+
+    int size() const { return n; }
+    vec2 operator[](int i) const { return {xs[i], ys[i]}; }
+    void set(int i, const vec2& p) {
+        xs[i] = p.x;
+        ys[i] = p.y;
+    }
+    void push_back(const vec2& p) {
+        if ((n & 7) == 0) {
+            xs.resize(n + 8);
+            ys.resize(n + 8);
+        }
+        set(n++, p);
+    }
+    // 最后一个点挪到 i, 顺序会变
+    void swapRemove(int i) {
+        set(i, (*this)[n - 1]);
+        if ((--n & 7) == 0) {
+            xs.resize(n);
+            ys.resize(n);
+        }
+    }
+    // 完全相等的第一个点, 没有返回 -1
+    int find(const vec2& p) const {
+        for (int i = 0; i < n; ++i)
+            if ((*this)[i] == p) return i;
+        return -1;
+    }
+    void clear() {
+        xs.clear();
+        ys.clear();
+        n = 0;
+    }
+    void reserve(int count) {
+        xs.reserve((count + 7) & ~7);
+        ys.reserve((count + 7) & ~7);
+    }
+    size_t capacityBytes() const { return (xs.capacity() + ys.capacity()) * sizeof(float); }
+
+    // range 内的点按顺序追加到 out 后面
+    template <class Range>
+    void appendInRange(const Range& range, vector<vec2>& out) const {
+        const int blockCount = this->blockCount();
+#ifdef __AVX2__
+        const __m256i* table = compressTable8();
+        size_t outCnt = out.size();
+        for (int b = 0; b < blockCount; ++b) {
+            uint32_t mask = blockMask(b, range);
+            if (!mask) continue;
+            // compress-store每次写满8个, 预留位置 (只在有命中的块上扩, 叶子大命中少时不用整段初始化)
+            out.resize(outCnt + 8);
+            __m256i perm = _mm256_load_si256(&table[mask]);
+            __m256 x = _mm256_permutevar8x32_ps(_mm256_loadu_ps(&xs[b * 8]), perm);
+            __m256 y = _mm256_permutevar8x32_ps(_mm256_loadu_ps(&ys[b * 8]), perm);
+            // x0 y0 x1 y1 | x4 y4 x5 y5  和  x2 y2 x3 y3 | x6 y6 x7 y7, 再按128位拼回顺序
+            __m256 lo = _mm256_unpacklo_ps(x, y), hi = _mm256_unpackhi_ps(x, y);
+            float* dst = &out[outCnt].x;
+            _mm256_storeu_ps(dst, _mm256_permute2f128_ps(lo, hi, 0x20));
+            _mm256_storeu_ps(dst + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+            outCnt += __builtin_popcount(mask);
+        }
+        out.resize(outCnt);
+#else
+        for (int b = 0; b < blockCount; ++b)
+            for (uint32_t mask = blockMask(b, range); mask; mask &= mask - 1) out.push_back((*this)[b * 8 + __builtin_ctz(mask)]);
+#endif
+    }
 
+    // range 内的点逐个调用 visit, 返回 false 就停止
+    template <class Range, class F>
+    bool visitInRange(const Range& range, F& visit) const {
+        for (int b = 0; b < blockCount(); ++b)
+            for (uint32_t mask = blockMask(b, range); mask; mask &= mask - 1)
+                if (!visit((*this)[b * 8 + __builtin_ctz(mask)])) return false;
+        return true;
+    }
+};
+
+// Capacity: 叶子里的点数超过 Capacity 就分裂 (默认 3).
+// MaxDepth: 到这一层就不再分裂, 叶子里点数不设上限. 否则一簇重复点 (超过 Capacity 个) 会一直分裂下去, 栈溢出.
+// 模板参数方便按数据集调: 点很密时加大 Capacity, 树浅一些, 叶子里线性扫.
+// C++17 的 CTAD: QuadTreeNode qt(bounds) 就是 QuadTreeNode<3, 10>.
+template <int Capacity = 3, int MaxDepth = 10>
 class QuadTreeNode {
+    static_assert(Capacity > 0 && MaxDepth >= 0, "bad quadtree parameters");
+
     // 当前node对应的矩形
     AABB bounds;
-    // 当前AABB范围内的点个数, 如果超过CAPACITY=3个了, 就分裂, 最多3个点.
-    vector<vec2> pts;
+    // 当前AABB范围内的点个数, 如果超过Capacity个了, 就分裂. SoA存, 叶子扫描用SIMD.
+    LeafPoints pts;
     // true代表当前node已经分裂, 不是叶子node了.
     bool divided = false;
 
     // 孩子
     unique_ptr<QuadTreeNode> nw, ne, sw, se;
 
+    // 整棵子树里的点数, remove 后用它判断是否可以合并孩子
+    int count = 0;
+
     // 当前node的depth, root node的depth=0, 往下+1
-    // 到达了MAX_DEPTH就不分裂了.
-    // int depth;
+    // 到达了MaxDepth就不分裂了.
+    int depth = 0;
 
     // 按AABB的中心, 分裂成4个.
     void subdivide() {
         vec2 mid = (bounds.min + bounds.max) * 0.5f;
-        nw = make_unique<QuadTreeNode>(AABB{{bounds.min.x, mid.y}, {mid.x, bounds.max.y}});
-        ne = make_unique<QuadTreeNode>(AABB{{mid.x, mid.y}, {bounds.max.x, bounds.max.y}});
-        sw = make_unique<QuadTreeNode>(AABB{{bounds.min.x, bounds.min.y}, {mid.x, mid.y}});
-        se = make_unique<QuadTreeNode>(AABB{{mid.x, bounds.min.y}, {bounds.max.x, mid.y}});
+        nw = make_unique<QuadTreeNode>(AABB{{bounds.min.x, mid.y}, {mid.x, bounds.max.y}}, depth + 1);
+        ne = make_unique<QuadTreeNode>(AABB{{mid.x, mid.y}, {bounds.max.x, bounds.max.y}}, depth + 1);
+        sw = make_unique<QuadTreeNode>(AABB{{bounds.min.x, bounds.min.y}, {mid.x, mid.y}}, depth + 1);
+        se = make_unique<QuadTreeNode>(AABB{{mid.x, bounds.min.y}, {bounds.max.x, mid.y}}, depth + 1);
         divided = true;
 
         // 分裂后, 将当前AABB范围内的点分到4个子node, 当前变成internal node, 就不再拥有点了.
-        for (auto& p : pts)
+        for (const vec2& p : pts)
             (nw->insert(p) || ne->insert(p) || sw->insert(p) || se->insert(p));
         pts.clear();
     }
 
+    // subdivide 的反操作: 子树里的点收回到当前node, 孩子释放掉
+    void collectInto(LeafPoints& out) const {
+        if (!divided) {
+            for (const vec2& p : pts) out.push_back(p);
+            return;
+        }
+        nw->collectInto(out);
+        ne->collectInto(out);
+        sw->collectInto(out);
+        se->collectInto(out);
+    }
+
+    void collapse() {
+        pts.reserve(count);
+        nw->collectInto(pts);
+        ne->collectInto(pts);
+        sw->collectInto(pts);
+        se->collectInto(pts);
+        nw.reset();
+        ne.reset();
+        sw.reset();
+        se.reset();
+        divided = false;
+    }
+
+    // 删掉一个点后, 子树总数不超过 Capacity 就合并成叶子
+    void onRemoved() {
+        --count;
+        if (divided && count <= Capacity) collapse();
+    }
+
+    void nearestImpl(const vec2& p, vec2& out, float& best2) const {
+        if (!divided) {
+            for (const vec2& q : pts) {
+                vec2 d = q - p;
+                float qd2 = dot(d, d);
+                if (qd2 < best2) {
+                    best2 = qd2;
+                    out = q;
+                }
+            }
+            return;
+        }
+        pair<float, const QuadTreeNode*> order[4] = {{nw->bounds.distance2(p), nw.get()},
+                                                     {ne->bounds.distance2(p), ne.get()},
+                                                     {sw->bounds.distance2(p), sw.get()},
+                                                     {se->bounds.distance2(p), se.get()}};
+        // 4个元素, 插入排序
+        for (int i = 1; i < 4; ++i)
+            for (int j = i; j > 0 && order[j].first < order[j - 1].first; --j) swap(order[j], order[j - 1]);
+        for (auto& [d2, c] : order) {
+            if (d2 >= best2) break;
+            if (c->count) c->nearestImpl(p, out, best2);
+        }
+    }
+
+    // 如果 range 不与 bounds 相交，肯定不会和孩子相交; 叶子里整块 SIMD 测试, compress-store 到 out
+    template <class Range>
+    void collect(const Range& range, vector<vec2>& out) const {
+        if (!range.intersects(bounds)) return;
+        if (!divided) {
+            pts.appendInRange(range, out);
+            return;
+        }
+        nw->collect(range, out);
+        ne->collect(range, out);
+        sw->collect(range, out);
+        se->collect(range, out);
+    }
+
+    enum class MoveResult { NotFound, Moved, Removed };
+
+    // Removed: from 已经从子树里删掉, 但 to 不在这棵子树里, 由祖先负责插入
+    MoveResult moveImpl(const vec2& from, const vec2& to) {
+        if (!bounds.contains(from)) return MoveResult::NotFound;
+        if (!divided) {
+            int i = pts.find(from);
+            if (i < 0) return MoveResult::NotFound;
+            // 还在同一个叶子里: 原地改坐标
+            if (bounds.contains(to)) {
+                pts.set(i, to);
+                return MoveResult::Moved;
+            }
+            pts.swapRemove(i);
+            --count;
+            return MoveResult::Removed;
+        }
+        MoveResult r = nw->moveImpl(from, to);
+        if (r == MoveResult::NotFound) r = ne->moveImpl(from, to);
+        if (r == MoveResult::NotFound) r = sw->moveImpl(from, to);
+        if (r == MoveResult::NotFound) r = se->moveImpl(from, to);
+        if (r != MoveResult::Removed) return r;
+        // 从离得最近的、包含 to 的祖先重新插入, 不用回到 root
+        if (bounds.contains(to)) {
+            --count;
+            insert(to);
+            return MoveResult::Moved;
+        }
+        onRemoved();
+        return MoveResult::Removed;
+    }
+
 public:
-    explicit QuadTreeNode(const AABB& b) : bounds(b) {}
+    explicit QuadTreeNode(const AABB& b, int depth = 0) : bounds(b), depth(depth) {}
 
     // true - 插入成功
     bool insert(const vec2& p) {
         if (!bounds.contains(p)) return false;
-        if (!divided && (int)pts.size() <= CAPACITY) {
+        if (!divided && ((int)pts.size() < Capacity || depth == MaxDepth)) {
             pts.push_back(p);
+            ++count;
             return true;
         }
         if (!divided) subdivide();
+        ++count;
         return nw->insert(p) || ne->insert(p) || sw->insert(p) || se->insert(p);
     }
 
+    // true - 找到并删掉了一个和 p 完全相等的点 (有重复点时只删一个)
+    bool remove(const vec2& p) {
+        if (!bounds.contains(p)) return false;
+        if (!divided) {
+            int i = pts.find(p);
+            if (i < 0) return false;
+            pts.swapRemove(i);
+            --count;
+            return true;
+        }
+        if (!(nw->remove(p) || ne->remove(p) || sw->remove(p) || se->remove(p))) return false;
+        onRemoved();
+        return true;
+    }
+
+    // 把点 from 挪到 to. 还在同一个叶子里就原地改; 否则往上找到包含 to 的最近祖先再插入.
+    // false - from 不存在, 或 to 在 root 范围外 (树不变)
+    bool move(const vec2& from, const vec2& to) {
+        if (!bounds.contains(to)) return false;
+        return moveImpl(from, to) == MoveResult::Moved;
+    }
+
+    // k 近邻 (best-first): node 按到 p 的最近距离进小顶堆, 结果放在大小为 k 的大顶堆里.
+    // 弹出的 node 比当前第 k 近的点还远时, 剩下的 node 都更远, 直接结束.
+    // maxDistance: 只要这个半径内的点 (radius-nearest). out 按距离从近到远.
+    void nearest(const vec2& p, size_t k, vector<vec2>& out, float maxDistance = numeric_limits<float>::infinity()) const {
+        out.clear();
+        if (k == 0 || count == 0) return;
+
+        using NodeItem = pair<float, const QuadTreeNode*>;
+        using PointItem = pair<float, vec2>;
+        auto nodeGreater = [](const NodeItem& l, const NodeItem& r) { return l.first > r.first; };
+        auto pointLess = [](const PointItem& l, const PointItem& r) { return l.first < r.first; };
+        priority_queue<NodeItem, vector<NodeItem>, decltype(nodeGreater)> nodes(nodeGreater);
+        priority_queue<PointItem, vector<PointItem>, decltype(pointLess)> best(pointLess);
+
+        // 结果满 k 个之前, 上限是 maxDistance; 满了之后是第 k 近的距离
+        float limit2 = maxDistance * maxDistance;
+        auto bound2 = [&] { return best.size() < k ? limit2 : best.top().first; };
+
+        nodes.push({bounds.distance2(p), this});
+        while (!nodes.empty()) {
+            auto [d2, node] = nodes.top();
+            nodes.pop();
+            if (d2 > bound2()) break;
+            if (!node->divided) {
+                for (const vec2& q : node->pts) {
+                    vec2 d = q - p;
+                    float qd2 = dot(d, d);
+                    if (qd2 > bound2() || (best.size() == k && qd2 == best.top().first)) continue;
+                    if (best.size() == k) best.pop();
+                    best.push({qd2, q});
+                }
+                continue;
+            }
+            for (const QuadTreeNode* c : {node->nw.get(), node->ne.get(), node->sw.get(), node->se.get()}) {
+                if (c->count == 0) continue;
+                float cd2 = c->bounds.distance2(p);
+                if (cd2 <= bound2()) nodes.push({cd2, c});
+            }
+        }
+
+        out.resize(best.size());
+        for (size_t i = best.size(); i-- > 0; best.pop()) out[i] = best.top().second;
+    }
+
+    // 半径 r 内的所有点, 按距离从近到远
+    void radiusNearest(const vec2& p, float r, vector<vec2>& out) const { nearest(p, numeric_limits<size_t>::max(), out, r); }
+
+    // 最近的一个点: 不用堆, 深度优先, 孩子按距离从近到远访问, 用当前最好距离剪枝.
+    // false - 树是空的
+    bool nearest(const vec2& p, vec2& out) const {
+        float best2 = numeric_limits<float>::infinity();
+        nearestImpl(p, out, best2);
+        return best2 != numeric_limits<float>::infinity();
+    }
+
+    int size() const { return count; }
+    size_t nodeCount() const { return divided ? 1 + nw->nodeCount() + ne->nodeCount() + sw->nodeCount() + se->nodeCount() : 1; }
+
     // 输入一个AABB/举行 range, 输出该范围内的点
-    void query(const AABB& range, vector<vec2>& out) const {
+    void query(const AABB& range, vector<vec2>& out) const { collect(range, out); }
+
+    // 圆形范围, 和AABB共用 collect
+    void query(const Circle& range, vector<vec2>& out) const { collect(range, out); }
+
+    // visitor 版本: Range = AABB 或 Circle (都有 intersects(AABB) 和 contains(vec2)).
+    // 每个命中的点调用 visit(p), 返回 false 就停止整个查询, 不用把结果放到 vector 里.
+    // 返回 false 代表被 visit 提前停止.
+    template <class Range, class F, class = enable_if_t<is_invocable_r_v<bool, F, const vec2&>>>
+    bool query(const Range& range, F&& visit) const {
         // 如果 range 不与 bounds 相交，肯定不会和孩子相交, 直接返回
-        if (!bounds.intersects(range)) return;
+        if (!range.intersects(bounds)) return true;
 
-        if (!divided) {
-            // 叶子node, 看看里面的点是否在 range 内
-            for (auto& p : pts)
-                if (range.contains(p)) out.push_back(p);
-        } else {
-            // 如果当前 node 已经分裂了，internal node没有保留点, 继续递归
-            nw->query(range, out);
-            ne->query(range, out);
-            sw->query(range, out);
-            se->query(range, out);
+        // 叶子node, 一次测8个点是否在 range 内
+        if (!divided) return pts.visitInRange(range, visit);
+        // 如果当前 node 已经分裂了，internal node没有保留点, 继续递归
+        return nw->query(range, visit) && ne->query(range, visit) && sw->query(range, visit) && se->query(range, visit);
+    }
+
+    // 整棵树占的堆内存(估算): node本身 + pts的capacity, 用来和 LinearQuadTree 对比
+    size_t memoryBytes() const {
+        size_t bytes = sizeof(*this) + pts.capacityBytes();
+        if (divided) bytes += nw->memoryBytes() + ne->memoryBytes() + sw->memoryBytes() + se->memoryBytes();
+        return bytes;
+    }
+};
+
+//=========================================================
+// Linear quadtree (Morton 序)
+/*
+QuadTreeNode 的问题: 每次分裂 make_unique 4个孩子, 每个node还有自己的 vector<vec2>,
+查询时在零散的堆内存之间跳来跳去(pointer chasing), cache miss 多, 额外内存也多.
+
+LinearQuadTree:
+    1. 把 bounds 量化成 2^16 x 2^16 的格子, 每个点得到 (qx, qy), 交错成 32bit 的 Morton code (Z-order).
+       同一个象限里的点 Morton code 前缀相同 => 按 code 排序后, 任何一个 quadtree node 的点都是数组里连续的一段.
+    2. 所有点按 code 排好序放在一个 vector<vec2> 里; node 只存 [begin, end) 和 firstChild,
+       4个孩子在 nodes 数组里连续存放 (firstChild..firstChild+3), 不用指针.
+    3. node 的格子坐标 (cx, cy, level) 在遍历时从父亲推出来, 不用存.
+
+Morton code 里 x 在偶数位, y 在奇数位, 所以孩子下标 = (ybit << 1) | xbit:
+    0 = sw, 1 = se, 2 = nw, 3 = ne.
+
+量化函数 q(v) = clamp(floor((v - min) * scale)) 是单调不减的, 所以
+    a <= p <= b  =>  q(a) <= q(p) <= q(b)
+用量化后的整数做剪枝不会漏点; 反过来 q(a) < q(p) 能推出 a < p,
+所以 node 的格子严格落在查询范围的量化区间内时, 整段点直接拷贝, 不用逐个测试.
+*/
+
+// 1 = subtest3 里跑 1M 点的构建计时, subtest8 里跑不同叶子大小的查询计时
+#define RUN_QUAD_BENCH 0
+
+// 每个叶子最多点数 / 最大层数(16层时格子已经是1个量化单位, 重复点也不会无限分裂)
+#define LINEAR_CAPACITY 8
+#define LINEAR_MAX_LEVEL 16
+
+// 16bit -> 把每一位隔开: abcd -> 0a0b0c0d
+inline uint32_t mortonPart1By1(uint32_t v) {
+    v &= 0x0000ffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+inline uint32_t mortonEncode2D(uint32_t x, uint32_t y) { return mortonPart1By1(x) | (mortonPart1By1(y) << 1); }
+
+class LinearQuadTree {
+public:
+    struct Node {
+        uint32_t begin = 0, end = 0;  // pts[begin, end)
+        uint32_t firstChild = 0;      // 0 = 叶子 (root 是 0 号, 不会是别人的孩子)
+    };
+
+    // 批量构建, 只收 bounds 内的点 (和 QuadTreeNode::insert 一致).
+    // threads > 1 时算 key / radix sort / 搬点 都按段并行, 结果和单线程完全一样.
+    void build(const AABB& b, const vec2* data, size_t count, unsigned threads = 1) {
+        bounds = b;
+        scale = vec2(float(GRID)) / (b.max - b.min);
+        nodes.clear();
+
+        const unsigned T = count < PARALLEL_MIN_POINTS ? 1 : max(1u, threads);
+        keys.resize(count);
+        order.resize(count);
+
+        // 1. 每段把 bounds 内的点的 (key, 下标) 紧凑写到本段开头, 再把各段挪到一起
+        vector<size_t> kept(T);
+        parallelChunks(count, T, [&](unsigned t, size_t begin, size_t end) {
+            size_t w = begin;
+            for (size_t i = begin; i < end; ++i) {
+                const vec2& p = data[i];
+                if (!bounds.contains(p)) continue;
+                keys[w] = mortonEncode2D(quantize(p.x, 0), quantize(p.y, 1));
+                order[w] = (uint32_t)i;
+                ++w;
+            }
+            kept[t] = w - begin;
+        });
+        size_t n = 0;
+        for (unsigned t = 0; t < T; ++t) {
+            size_t begin = chunkBegin(count, T, t);
+            if (n != begin) {
+                copy(keys.begin() + begin, keys.begin() + begin + kept[t], keys.begin() + n);
+                copy(order.begin() + begin, order.begin() + begin + kept[t], order.begin() + n);
+            }
+            n += kept[t];
         }
+        keys.resize(n);
+        order.resize(n);
+
+        // 2. LSD radix sort, 稳定: 相同 code 的点保持输入顺序
+        radixSort(T);
+
+        // 3. 按排好的顺序搬点
+        pts.resize(n);
+        parallelChunks(n, T, [&](unsigned, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) pts[i] = data[order[i]];
+        });
+
+        // 4. 自顶向下分裂, 每个node只在自己的区间里做 galloping search 找孩子分界
+        nodes.push_back({0, (uint32_t)n, 0});
+        split(0, 0, 0);
+    }
+
+    void build(const AABB& b, const vector<vec2>& input, unsigned threads = 1) { build(b, input.data(), input.size(), threads); }
+
+    void query(const AABB& range, vector<vec2>& out) const {
+        if (nodes.empty() || !bounds.intersects(range)) return;
+        visit(range, range, out);
     }
 
-    // 和AABB一样的代码, 用多肽.
     void query(const Circle& range, vector<vec2>& out) const {
-        if (!range.intersects(bounds)) return;
-        if (!divided) {
-            for (auto& p : pts)
-                if (range.contains(p)) out.push_back(p);
+        AABB box{range.center - vec2(range.r), range.center + vec2(range.r)};
+        if (nodes.empty() || !bounds.intersects(box)) return;
+        visit(box, range, out);
+    }
+
+    size_t size() const { return pts.size(); }
+    size_t nodeCount() const { return nodes.size(); }
+    const vector<vec2>& points() const { return pts; }
+    // 查询用到的内存, 不含构建用的 scratch (keys/order, 留着给每帧重建复用)
+    size_t memoryBytes() const { return sizeof(*this) + pts.capacity() * sizeof(vec2) + nodes.capacity() * sizeof(Node); }
+
+private:
+    static constexpr uint32_t GRID = 1u << LINEAR_MAX_LEVEL;
+    // 点太少时开线程不划算
+    static constexpr size_t PARALLEL_MIN_POINTS = 1 << 16;
+
+    AABB bounds{};
+    vec2 scale{};
+    vector<vec2> pts;
+    vector<Node> nodes;
+
+    // 构建用的 scratch: Morton key 和对应的输入下标
+    vector<uint32_t> keys, order;
+    vector<uint32_t> keysTmp, orderTmp;
+
+    static size_t chunkBegin(size_t n, unsigned T, unsigned t) { return n * t / T; }
+
+    // 把 [0, n) 切成 T 段, f(t, begin, end); 第0段在调用线程上跑
+    template <class F>
+    static void parallelChunks(size_t n, unsigned T, F&& f) {
+        vector<thread> workers;
+        for (unsigned t = 1; t < T; ++t) workers.emplace_back([&, t] { f(t, chunkBegin(n, T, t), chunkBegin(n, T, t + 1)); });
+        f(0, chunkBegin(n, T, 0), chunkBegin(n, T, 1));
+        for (auto& w : workers) w.join();
+    }
+
+    // 4趟, 每趟8bit. 每段统计自己的直方图, 按 (digit, 段) 的顺序做前缀和, 段内顺序写出 => 稳定.
+    // 所有 key 这8位都相同时整趟跳过 (点集中在一小块区域时高位常常如此).
+    void radixSort(unsigned T) {
+        const size_t n = keys.size();
+        keysTmp.resize(n);
+        orderTmp.resize(n);
+        vector<array<size_t, 256>> hist(T);
+        for (int shift = 0; shift < 32; shift += 8) {
+            parallelChunks(n, T, [&](unsigned t, size_t begin, size_t end) {
+                hist[t].fill(0);
+                for (size_t i = begin; i < end; ++i) ++hist[t][(keys[i] >> shift) & 0xff];
+            });
+            bool single = false;
+            for (int d = 0; d < 256 && !single; ++d) {
+                size_t total = 0;
+                for (unsigned t = 0; t < T; ++t) total += hist[t][d];
+                single = total == n;
+            }
+            if (single) continue;
+
+            size_t offset = 0;
+            for (int d = 0; d < 256; ++d)
+                for (unsigned t = 0; t < T; ++t) {
+                    size_t c = hist[t][d];
+                    hist[t][d] = offset;
+                    offset += c;
+                }
+            parallelChunks(n, T, [&](unsigned t, size_t begin, size_t end) {
+                auto& pos = hist[t];
+                for (size_t i = begin; i < end; ++i) {
+                    size_t dst = pos[(keys[i] >> shift) & 0xff]++;
+                    keysTmp[dst] = keys[i];
+                    orderTmp[dst] = order[i];
+                }
+            });
+            keys.swap(keysTmp);
+            order.swap(orderTmp);
+        }
+    }
+
+    // 在 keys[lo, hi) 里找第一个 >= target 的位置. 先从 lo 开始按 1,2,4.. 往后跳, 再在最后一跳里二分,
+    // 代价是 O(log 距离) 而不是 O(log 区间长度); 整棵树加起来是 O(n).
+    uint32_t gallop(uint32_t lo, uint32_t hi, uint32_t target) const {
+        if (lo == hi || keys[lo] >= target) return lo;
+        uint32_t bound = 1;
+        while (lo + bound < hi && keys[lo + bound] < target) bound *= 2;
+        auto first = keys.begin() + lo + bound / 2 + 1;
+        auto last = keys.begin() + min(lo + bound, hi);
+        return (uint32_t)(lower_bound(first, last, target) - keys.begin());
+    }
+
+    uint32_t quantize(float v, int axis) const {
+        float t = (v - bounds.min[axis]) * scale[axis];
+        if (!(t > 0.0f)) return 0;
+        if (t >= float(GRID - 1)) return GRID - 1;
+        return (uint32_t)t;
+    }
+
+    // 查询范围的量化区间; 超出 bounds 的一侧用 -1 / GRID, 这样贴边的 node 也能整段拷贝
+    int quantizeLo(float v, int axis) const { return v <= bounds.min[axis] ? -1 : (int)quantize(v, axis); }
+    int quantizeHi(float v, int axis) const { return v >= bounds.max[axis] ? (int)GRID : (int)quantize(v, axis); }
+
+    // keys 已排序, node 的点在 keys[begin, end) 中共享 level 层的前缀; 找4个孩子的分界
+    void split(uint32_t nodeIdx, uint32_t prefix, int level) {
+        Node n = nodes[nodeIdx];
+        if (n.end - n.begin <= LINEAR_CAPACITY || level == LINEAR_MAX_LEVEL) return;
+
+        uint32_t firstChild = (uint32_t)nodes.size();
+        nodes[nodeIdx].firstChild = firstChild;
+        int shift = 2 * (LINEAR_MAX_LEVEL - level - 1);
+        uint32_t begin = n.begin;
+        for (uint32_t c = 0; c < 4; ++c) {
+            uint32_t end = n.end;
+            if (c < 3) {
+                uint32_t nextKey = prefix | ((c + 1) << shift);
+                end = gallop(begin, n.end, nextKey);
+            }
+            nodes.push_back({begin, end, 0});
+            begin = end;
+        }
+        for (uint32_t c = 0; c < 4; ++c) split(firstChild + c, prefix | (c << shift), level + 1);
+    }
+
+    // box: 用来剪枝的 AABB (圆的话是它的包围盒), shape: 逐点精确测试
+    template <class Shape>
+    void visit(const AABB& box, const Shape& shape, vector<vec2>& out) const {
+        const int qx0 = quantizeLo(box.min.x, 0), qy0 = quantizeLo(box.min.y, 1);
+        const int qx1 = quantizeHi(box.max.x, 0), qy1 = quantizeHi(box.max.y, 1);
+        constexpr bool isBox = is_same<Shape, AABB>::value;
+
+        struct Item {
+            uint32_t node;
+            int cx, cy, level;
+        };
+        // 每层最多压3个兄弟 + 1
+        Item stack[3 * LINEAR_MAX_LEVEL + 4];
+        int top = 0;
+        stack[top++] = {0, 0, 0, 0};
+        while (top) {
+            Item it = stack[--top];
+            const Node& n = nodes[it.node];
+            if (n.begin == n.end) continue;
+            int cellSize = (int)(GRID >> it.level);
+            int cx1 = it.cx + cellSize - 1, cy1 = it.cy + cellSize - 1;
+            if (cx1 < qx0 || it.cx > qx1 || cy1 < qy0 || it.cy > qy1) continue;
+
+            // 格子严格在查询区间内: 整段拷贝
+            if (isBox && qx0 < it.cx && cx1 < qx1 && qy0 < it.cy && cy1 < qy1) {
+                out.insert(out.end(), pts.begin() + n.begin, pts.begin() + n.end);
+                continue;
+            }
+            if (n.firstChild == 0) {
+                for (uint32_t i = n.begin; i < n.end; ++i)
+                    if (shape.contains(pts[i])) out.push_back(pts[i]);
+                continue;
+            }
+            int half = cellSize >> 1;
+            for (int c = 3; c >= 0; --c)
+                stack[top++] = {n.firstChild + (uint32_t)c, it.cx + (c & 1) * half, it.cy + (c >> 1) * half, it.level + 1};
+        }
+    }
+};
+
+//=========================================================
+// Loose quadtree (有大小的物体)
+/*
+QuadTreeNode 只存点. 有大小的物体(AABB/Circle)如果按普通 quadtree 放:
+    要么放在完全包含它的最深 node => 跨在分界线上的小物体会被卡在很浅的层(甚至 root);
+    要么复制到所有相交的 node => 更新/删除要处理多份.
+Loose quadtree: 每个 node 的 "松" 边界 = 格子向四周各扩半个格子 (边长 x2).
+    物体尺寸 <= 格子尺寸时, 只要中心在格子里, 物体就一定在松边界里.
+    => 层级直接由物体尺寸算出: cellSize(L) = worldSize / 2^L, 取满足 extent <= cellSize(L) 的最大 L, O(1).
+    => 格子由中心点算出, 每个物体只放一份.
+代价是松边界彼此重叠, 查询时要多看一些 node.
+中心在 world 外的物体放在 root, root 的物体总是逐个测试.
+*/
+
+inline AABB boundsOf(const AABB& b) { return b; }
+inline AABB boundsOf(const Circle& c) { return {c.center - vec2(c.r), c.center + vec2(c.r)}; }
+
+inline bool overlaps(const AABB& a, const AABB& b) { return a.intersects(b); }
+inline bool overlaps(const Circle& c, const AABB& b) { return c.intersects(b); }
+inline bool overlaps(const AABB& b, const Circle& c) { return c.intersects(b); }
+inline bool overlaps(const Circle& a, const Circle& b) {
+    vec2 d = a.center - b.center;
+    float r = a.r + b.r;
+    return dot(d, d) <= r * r;
+}
+
+// Shape = AABB 或 Circle
+template <class Shape>
+class LooseQuadTree {
+public:
+    using Handle = uint32_t;
+
+    explicit LooseQuadTree(const AABB& world, int maxDepth = 8) : world(world), worldSize(world.max - world.min), maxDepth(maxDepth) {
+        assert(maxDepth >= 0 && maxDepth < 32);
+        nodes.emplace_back();
+    }
+
+    Handle insert(const Shape& s) {
+        Handle h;
+        if (!freeHandles.empty()) {
+            h = freeHandles.back();
+            freeHandles.pop_back();
         } else {
-            nw->query(range, out);
-            ne->query(range, out);
-            sw->query(range, out);
-            se->query(range, out);
+            h = (Handle)entries.size();
+            entries.emplace_back();
+        }
+        entries[h].shape = s;
+        entries[h].alive = true;
+        link(h, locate(boundsOf(s)));
+        ++alive;
+        return h;
+    }
+
+    // 删掉后 handle 会被复用, 不要再用
+    void remove(Handle h) {
+        assert(h < entries.size() && entries[h].alive);
+        unlink(h);
+        entries[h].alive = false;
+        freeHandles.push_back(h);
+        --alive;
+    }
+
+    // 还在同一个 node 里就只改 shape, 否则从旧 node 摘下挂到新 node
+    // true - 原地更新
+    bool update(Handle h, const Shape& s) {
+        assert(h < entries.size() && entries[h].alive);
+        Location loc = locate(boundsOf(s));
+        Entry& e = entries[h];
+        e.shape = s;
+        if (nodes[e.node].level == loc.level && nodes[e.node].cx == loc.cx && nodes[e.node].cy == loc.cy) return true;
+        unlink(h);
+        link(h, loc);
+        return false;
+    }
+
+    const Shape& shape(Handle h) const { return entries[h].shape; }
+    int levelOf(Handle h) const { return nodes[entries[h].node].level; }
+    size_t size() const { return alive; }
+    size_t nodeCount() const { return nodes.size() - freeNodes.size(); }
+
+    // Range = AABB 或 Circle, 输出和 range 相交的物体
+    template <class Range>
+    void query(const Range& range, vector<Handle>& out) const {
+        const AABB box = boundsOf(range);
+        uint32_t stack[32 * 3 + 4];
+        int top = 0;
+        stack[top++] = 0;
+        while (top) {
+            const Node& n = nodes[stack[--top]];
+            // root 不按松边界剪枝: world 外的物体也挂在 root
+            if (n.count == 0 || (n.level > 0 && !looseBounds(n.level, n.cx, n.cy).intersects(box))) continue;
+            for (Handle h : n.items) {
+                const Shape& s = entries[h].shape;
+                if (boundsOf(s).intersects(box) && overlaps(s, range)) out.push_back(h);
+            }
+            for (int c = 3; c >= 0; --c)
+                if (n.child[c] >= 0) stack[top++] = (uint32_t)n.child[c];
+        }
+    }
+
+private:
+    struct Node {
+        int child[4] = {-1, -1, -1, -1};
+        int level = 0;
+        uint32_t cx = 0, cy = 0;  // level 层的格子坐标
+        uint32_t parent = 0;
+        int count = 0;            // 子树里的物体数, 查询时跳过空子树
+        vector<Handle> items;
+    };
+    struct Entry {
+        Shape shape{};
+        uint32_t node = 0;
+        uint32_t slot = 0;  // 在 node.items 里的下标, 删除时 O(1)
+        bool alive = false;
+    };
+    struct Location {
+        int level;
+        uint32_t cx, cy;
+    };
+
+    AABB world;
+    vec2 worldSize;
+    int maxDepth;
+    vector<Node> nodes;
+    vector<Entry> entries;
+    vector<Handle> freeHandles;
+    vector<uint32_t> freeNodes;  // 空了摘掉的 node, link 的时候复用
+    size_t alive = 0;
+
+    vec2 cellSize(int level) const { return worldSize * (1.0f / float(1u << level)); }
+
+    AABB looseBounds(int level, uint32_t cx, uint32_t cy) const {
+        vec2 cs = cellSize(level);
+        vec2 cellMin = world.min + vec2(float(cx), float(cy)) * cs;
+        return {cellMin - cs * 0.5f, cellMin + cs * 1.5f};
+    }
+
+    // 满足 extent <= worldSize / 2^L 的最大 L: frexp 取 worldSize/extent 的指数, 不用循环
+    int levelForExtent(float extent, float size) const {
+        if (!(extent > 0.0f)) return maxDepth;
+        int e;
+        frexp(size / extent, &e);  // size/extent = m * 2^e, m in [0.5, 1)
+        return std::clamp(e - 1, 0, maxDepth);
+    }
+
+    Location locate(const AABB& b) const {
+        vec2 center = (b.min + b.max) * 0.5f;
+        if (!world.contains(center)) return {0, 0, 0};
+        vec2 extent = b.max - b.min;
+        int level = min(levelForExtent(extent.x, worldSize.x), levelForExtent(extent.y, worldSize.y));
+        // 浮点舍入可能差一点点, 用查询时同样的松边界验证, 不满足就往上一层 (很少发生)
+        for (;; --level) {
+            uint32_t n = 1u << level;
+            vec2 cs = cellSize(level);
+            uint32_t cx = min(n - 1, (uint32_t)((center.x - world.min.x) / cs.x));
+            uint32_t cy = min(n - 1, (uint32_t)((center.y - world.min.y) / cs.y));
+            AABB loose = looseBounds(level, cx, cy);
+            if (level == 0 || (loose.contains(b.min) && loose.contains(b.max))) return {level, cx, cy};
+        }
+    }
+
+    // 从 root 按格子坐标的位往下走, 缺的 node 现建
+    void link(Handle h, const Location& loc) {
+        uint32_t idx = 0;
+        ++nodes[0].count;
+        for (int l = 1; l <= loc.level; ++l) {
+            int shift = loc.level - l;
+            int c = (int)(((loc.cx >> shift) & 1) | (((loc.cy >> shift) & 1) << 1));
+            if (nodes[idx].child[c] < 0) {
+                Node child;
+                child.level = l;
+                child.cx = loc.cx >> shift;
+                child.cy = loc.cy >> shift;
+                child.parent = idx;
+                uint32_t ci;
+                if (!freeNodes.empty()) {
+                    ci = freeNodes.back();
+                    freeNodes.pop_back();
+                    nodes[ci] = move(child);
+                } else {
+                    ci = (uint32_t)nodes.size();
+                    nodes.push_back(move(child));
+                }
+                nodes[idx].child[c] = (int)ci;
+            }
+            idx = (uint32_t)nodes[idx].child[c];
+            ++nodes[idx].count;
+        }
+        Entry& e = entries[h];
+        e.node = idx;
+        e.slot = (uint32_t)nodes[idx].items.size();
+        nodes[idx].items.push_back(h);
+    }
+
+    void unlink(Handle h) {
+        Entry& e = entries[h];
+        auto& items = nodes[e.node].items;
+        Handle last = items.back();
+        items[e.slot] = last;
+        entries[last].slot = e.slot;
+        items.pop_back();
+        // 子树空了的 node 摘掉回收. 计数是 0 的 node 没有孩子, 摘下的是路径上从下往上的一段.
+        for (uint32_t idx = e.node;; idx = nodes[idx].parent) {
+            if (--nodes[idx].count == 0 && idx != 0) {
+                for (int& c : nodes[nodes[idx].parent].child)
+                    if (c == (int)idx) c = -1;
+                vector<Handle>().swap(nodes[idx].items);
+                freeNodes.push_back(idx);
+            }
+            if (idx == 0) break;
         }
     }
 };
 
-int cppMain() {
-    cout << "adding new test here." << endl;
+void subtest1() {
+    cout << __FUNCTION__ << endl;
 
     // srand((unsigned)time(nullptr));
     srand(41);
@@ -244,6 +1096,518 @@ int cppMain() {
     cout << "\nCircle hits: " << hits.size() << "\n";
     for (auto& p : hits)
         cout << "(" << p.x << ", " << p.y << ")\n";
+}
+
+// LinearQuadTree 和 QuadTreeNode 的查询结果一致 (顺序不同, 排序后比较)
+void subtest2() {
+    cout << __FUNCTION__ << endl;
+
+    auto sorted = [](vector<vec2> v) {
+        sort(v.begin(), v.end(), [](const vec2& l, const vec2& r) { return l.x != r.x ? l.x < r.x : l.y < r.y; });
+        return v;
+    };
+
+    srand(43);
+    AABB world{{-100, -100}, {100, 100}};
+    vector<vec2> input;
+    for (int i = 0; i < 20000; ++i) {
+        // 1/8 的点落在整数格上, 制造重复点和落在分界线上的点
+        if (i % 8 == 0)
+            input.push_back({(float)(rand() % 201 - 100), (float)(rand() % 201 - 100)});
+        else
+            input.push_back({rand() / (float)RAND_MAX * 200.0f - 100.0f, rand() / (float)RAND_MAX * 200.0f - 100.0f});
+    }
+    input.push_back({150, 0});  // bounds 外, 两边都不收
+
+    QuadTreeNode qt(world);
+    for (const vec2& p : input) qt.insert(p);
+    LinearQuadTree lqt;
+    lqt.build(world, input);
+    assert(lqt.size() == input.size() - 1);
+
+    size_t totalHits = 0;
+    for (int q = 0; q < 200; ++q) {
+        vec2 c{rand() % 240 - 120.0f, rand() % 240 - 120.0f};
+        vec2 e{rand() % 60 + 0.5f, rand() % 60 + 0.5f};
+        AABB rect{c - e, c + e};
+        vector<vec2> a, b;
+        qt.query(rect, a);
+        lqt.query(rect, b);
+        assert(sorted(a) == sorted(b));
+        totalHits += a.size();
+
+        Circle circle{c, e.x};
+        a.clear();
+        b.clear();
+        qt.query(circle, a);
+        lqt.query(circle, b);
+        assert(sorted(a) == sorted(b));
+        totalHits += a.size();
+    }
+    // 整个世界: 所有点都走整段拷贝
+    vector<vec2> all;
+    lqt.query(world, all);
+    assert(all.size() == lqt.size());
+
+    cout << "points " << lqt.size() << ", nodes " << lqt.nodeCount() << ", hits " << totalHits << endl;
+    cout << "memory: QuadTreeNode " << qt.memoryBytes() << " bytes, LinearQuadTree " << lqt.memoryBytes() << " bytes" << endl;
+    assert(lqt.memoryBytes() * 2 < qt.memoryBytes());
+}
+
+// 批量构建: 多线程和单线程结果一样, 反复重建复用 scratch, 查询和 QuadTreeNode 一致
+void subtest3() {
+    cout << __FUNCTION__ << endl;
+
+    auto randomPoints = [](size_t n, unsigned seed) {
+        srand(seed);
+        vector<vec2> v(n);
+        for (auto& p : v) p = {rand() / (float)RAND_MAX * 200.0f - 100.0f, rand() / (float)RAND_MAX * 200.0f - 100.0f};
+        return v;
+    };
+
+    AABB world{{-100, -100}, {100, 100}};
+    vector<vec2> input = randomPoints(200000, 44);
+
+    LinearQuadTree serial, parallel;
+    serial.build(world, input);
+    parallel.build(world, input, 4);
+    assert(serial.points() == parallel.points());
+    assert(serial.nodeCount() == parallel.nodeCount());
+
+    // 每帧重建: 点整体平移一点, 复用同一个对象
+    for (int frame = 0; frame < 3; ++frame) {
+        for (auto& p : input) p.x = p.x * 0.99f + 0.5f;
+        parallel.build(world, input, 4);
+    }
+    QuadTreeNode qt(world);
+    for (const vec2& p : input) qt.insert(p);
+    for (int q = 0; q < 50; ++q) {
+        vec2 c{rand() % 200 - 100.0f, rand() % 200 - 100.0f};
+        AABB rect{c - vec2(8), c + vec2(8)};
+        vector<vec2> a, b;
+        qt.query(rect, a);
+        parallel.query(rect, b);
+        assert(a.size() == b.size());
+    }
+    cout << "points " << parallel.size() << ", nodes " << parallel.nodeCount() << endl;
+
+    // 一簇重复点: 每层只有一个孩子非空, 到 LINEAR_MAX_LEVEL 就停止分裂
+    vector<vec2> dup(100, vec2(12.5f, -3.25f));
+    LinearQuadTree dupTree;
+    dupTree.build(world, dup);
+    assert(dupTree.nodeCount() == 1 + 4 * LINEAR_MAX_LEVEL);
+    vector<vec2> hits;
+    dupTree.query(Circle{{12.5f, -3.25f}, 0.01f}, hits);
+    assert(hits.size() == dup.size());
+
+#if RUN_QUAD_BENCH
+    // 1M 点: 逐个 insert vs 批量构建
+    input = randomPoints(1000000, 45);
+    auto seconds = [](auto&& f) {
+        auto t0 = chrono::steady_clock::now();
+        f();
+        return chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    };
+    double tInsert = seconds([&] {
+        QuadTreeNode tree(world);
+        for (const vec2& p : input) tree.insert(p);
+    });
+    LinearQuadTree bench;
+    double tBulk1 = seconds([&] { bench.build(world, input); });
+    tBulk1 = seconds([&] { bench.build(world, input); });
+    double tBulkN = seconds([&] { bench.build(world, input, thread::hardware_concurrency()); });
+    cout << "1M points: insert " << tInsert * 1000 << " ms, bulk " << tBulk1 * 1000 << " ms, bulk x" << thread::hardware_concurrency() << " "
+         << tBulkN * 1000 << " ms" << endl;
+#endif
+}
+
+// remove / move / 合并: 动态更新后的查询结果和每帧重建的树一致
+void subtest4() {
+    cout << __FUNCTION__ << endl;
+
+    auto sorted = [](vector<vec2> v) {
+        sort(v.begin(), v.end(), [](const vec2& l, const vec2& r) { return l.x != r.x ? l.x < r.x : l.y < r.y; });
+        return v;
+    };
+
+    srand(46);
+    AABB world{{-100, -100}, {100, 100}};
+    const int n = 2000;
+    vector<vec2> pos(n), vel(n);
+    QuadTreeNode qt(world);
+    for (int i = 0; i < n; ++i) {
+        pos[i] = {rand() / (float)RAND_MAX * 200.0f - 100.0f, rand() / (float)RAND_MAX * 200.0f - 100.0f};
+        vel[i] = {rand() / (float)RAND_MAX * 2.0f - 1.0f, rand() / (float)RAND_MAX * 2.0f - 1.0f};
+        qt.insert(pos[i]);
+    }
+    size_t nodesBefore = qt.nodeCount();
+
+    // 移动的实体: 大部分帧内位移很小, 在原叶子里原地更新
+    for (int frame = 0; frame < 20; ++frame) {
+        for (int i = 0; i < n; ++i) {
+            vec2 next = pos[i] + vel[i];
+            if (!world.contains(next)) {
+                vel[i] = -vel[i];
+                continue;
+            }
+            bool ok = qt.move(pos[i], next);
+            assert(ok);
+            pos[i] = next;
+        }
+        assert(qt.size() == n);
+    }
+    QuadTreeNode rebuilt(world);
+    for (const vec2& p : pos) rebuilt.insert(p);
+    for (int q = 0; q < 100; ++q) {
+        vec2 c{rand() % 200 - 100.0f, rand() % 200 - 100.0f};
+        Circle circle{c, (float)(rand() % 40 + 1)};
+        vector<vec2> a, b;
+        qt.query(circle, a);
+        rebuilt.query(circle, b);
+        assert(sorted(a) == sorted(b));
+    }
+    assert(!qt.move(vec2(1000, 1000), vec2(0, 0)));  // 不存在的点
+    assert(!qt.move(pos[0], vec2(500, 0)));          // 挪到 root 外面
+    assert(qt.size() == n);
+
+    // 删掉 3/4, 空的子树合并回去
+    int removed = 0;
+    for (int i = 0; i < n; ++i)
+        if (i % 4 != 0) removed += qt.remove(pos[i]);
+    assert(removed == n - n / 4);
+    assert(!qt.remove(pos[1]));
+    assert(qt.size() == n / 4);
+    cout << "nodes: " << nodesBefore << " -> " << qt.nodeCount() << " after removing 3/4" << endl;
+    assert(qt.nodeCount() < nodesBefore / 2);
+
+    vector<vec2> all;
+    qt.query(world, all);
+    assert((int)all.size() == n / 4);
+
+    // 全删掉只剩 root
+    for (int i = 0; i < n; i += 4) qt.remove(pos[i]);
+    assert(qt.size() == 0 && qt.nodeCount() == 1);
+}
+
+// kNN / radius-nearest / 最近点: 和暴力排序的距离一致
+void subtest5() {
+    cout << __FUNCTION__ << endl;
+
+    srand(47);
+    AABB world{{-100, -100}, {100, 100}};
+    vector<vec2> input(5000);
+    QuadTreeNode qt(world);
+    for (auto& p : input) {
+        p = {rand() / (float)RAND_MAX * 200.0f - 100.0f, rand() / (float)RAND_MAX * 200.0f - 100.0f};
+        qt.insert(p);
+    }
+
+    auto dist2 = [](const vec2& a, const vec2& b) { return dot(a - b, a - b); };
+    auto distances = [&](const vec2& p, const vector<vec2>& v) {
+        vector<float> d;
+        for (const vec2& q : v) d.push_back(dist2(p, q));
+        return d;
+    };
+
+    vector<vec2> hits;
+    for (int q = 0; q < 200; ++q) {
+        // 有一部分查询点在 bounds 外面
+        vec2 p{rand() % 260 - 130.0f, rand() % 260 - 130.0f};
+        vector<float> brute = distances(p, input);
+        sort(brute.begin(), brute.end());
+
+        for (size_t k : {1, 5, 32}) {
+            qt.nearest(p, k, hits);
+            assert(distances(p, hits) == vector<float>(brute.begin(), brute.begin() + k));
+        }
+
+        float r = (float)(rand() % 20 + 1);
+        qt.radiusNearest(p, r, hits);
+        size_t inside = upper_bound(brute.begin(), brute.end(), r * r) - brute.begin();
+        assert(distances(p, hits) == vector<float>(brute.begin(), brute.begin() + inside));
+
+        // 半径内最近的 3 个
+        qt.nearest(p, 3, hits, r);
+        assert(hits.size() == min<size_t>(3, inside));
+
+        vec2 closest;
+        bool found = qt.nearest(p, closest);
+        assert(found && dist2(p, closest) == brute[0]);
+    }
+    qt.nearest(vec2(0, 0), input.size() + 10, hits);
+    assert(hits.size() == input.size());
+
+    QuadTreeNode empty(world);
+    vec2 none;
+    assert(!empty.nearest(vec2(0, 0), none));
+
+    qt.nearest(vec2(0, 0), 3, hits);
+    cout << "3 nearest to origin:";
+    for (auto& p : hits) cout << " (" << p.x << ", " << p.y << ")";
+    cout << endl;
+}
+
+// loose quadtree: 查询和暴力一致, 物体小幅移动大多原地更新, 每个物体只存一份
+void subtest6() {
+    cout << __FUNCTION__ << endl;
+
+    srand(48);
+    auto frand = [](float lo, float hi) { return lo + rand() / (float)RAND_MAX * (hi - lo); };
+    AABB world{{-100, -100}, {100, 100}};
+
+    LooseQuadTree<AABB> boxes(world);
+    LooseQuadTree<Circle> circles(world);
+    vector<uint32_t> boxHandles, circleHandles;
+    for (int i = 0; i < 3000; ++i) {
+        // 尺寸从 0.01 到 50, 有一部分中心在 world 外
+        float size = pow(10.0f, frand(-2.0f, 1.7f));
+        vec2 c{frand(-110, 110), frand(-110, 110)};
+        boxHandles.push_back(boxes.insert(AABB{c - vec2(size, size * 0.5f), c + vec2(size, size * 0.5f)}));
+        circleHandles.push_back(circles.insert(Circle{c, size * 0.5f}));
+    }
+
+    auto check = [&](auto& tree, const vector<uint32_t>& handles, const auto& range) {
+        vector<uint32_t> got, expect;
+        tree.query(range, got);
+        for (uint32_t h : handles)
+            if (overlaps(tree.shape(h), range)) expect.push_back(h);
+        sort(got.begin(), got.end());
+        assert(got == expect);
+        return got.size();
+    };
+    auto checkAll = [&] {
+        size_t hits = 0;
+        for (int q = 0; q < 100; ++q) {
+            vec2 c{frand(-120, 120), frand(-120, 120)};
+            float r = frand(0.5f, 30);
+            AABB rect{c - vec2(r), c + vec2(r)};
+            Circle circle{c, r};
+            hits += check(boxes, boxHandles, rect) + check(boxes, boxHandles, circle);
+            hits += check(circles, circleHandles, rect) + check(circles, circleHandles, circle);
+        }
+        return hits;
+    };
+    size_t hits = checkAll();
+
+    // 移动: 每帧挪一小步
+    size_t inPlace = 0, updates = 0;
+    for (int frame = 0; frame < 10; ++frame) {
+        for (size_t i = 0; i < boxHandles.size(); ++i) {
+            vec2 v{frand(-0.1f, 0.1f), frand(-0.1f, 0.1f)};
+            AABB b = boxes.shape(boxHandles[i]);
+            inPlace += boxes.update(boxHandles[i], AABB{b.min + v, b.max + v});
+            Circle c = circles.shape(circleHandles[i]);
+            inPlace += circles.update(circleHandles[i], Circle{c.center + v, c.r});
+            updates += 2;
+        }
+    }
+    hits += checkAll();
+    assert(inPlace * 4 > updates * 3);
+
+    // 删掉一半, handle 复用
+    for (size_t i = 0; i < boxHandles.size(); i += 2) {
+        boxes.remove(boxHandles[i]);
+        circles.remove(circleHandles[i]);
+    }
+    vector<uint32_t> keptBoxes, keptCircles;
+    for (size_t i = 1; i < boxHandles.size(); i += 2) {
+        keptBoxes.push_back(boxHandles[i]);
+        keptCircles.push_back(circleHandles[i]);
+    }
+    boxHandles.swap(keptBoxes);
+    circleHandles.swap(keptCircles);
+    assert(boxes.size() == boxHandles.size());
+    uint32_t reused = boxes.insert(AABB{{0, 0}, {1, 1}});
+    assert(reused < 3000);
+    boxHandles.push_back(reused);
+    hits += checkAll();
+
+    cout << "levels: big box " << boxes.levelOf(boxes.insert(AABB{{-40, -40}, {40, 40}})) << ", small box "
+         << boxes.levelOf(boxes.insert(AABB{{10, 10}, {10.5f, 10.5f}})) << ", nodes " << boxes.nodeCount() << endl;
+    cout << "hits " << hits << ", in-place updates " << inPlace << "/" << updates << endl;
+}
+
+// 模板参数 Capacity / MaxDepth, 重复点不会无限分裂, visitor 查询提前结束
+void subtest7() {
+    cout << __FUNCTION__ << endl;
+
+    AABB world{{-100, -100}, {100, 100}};
+    // 一簇重复点: 分裂到 MaxDepth 为止, 最深的叶子放下所有点
+    QuadTreeNode<3, 6> dup(world);
+    for (int i = 0; i < 100; ++i) dup.insert(vec2(12.5f, -3.25f));
+    dup.insert(vec2(-50, 50));
+    assert(dup.size() == 101);
+    assert(dup.nodeCount() == 1 + 4 * 6);
+    vector<vec2> hits;
+    dup.query(Circle{{12.5f, -3.25f}, 0.01f}, hits);
+    assert(hits.size() == 100);
+    for (int i = 0; i < 100; ++i) dup.remove(vec2(12.5f, -3.25f));
+    assert(dup.size() == 1 && dup.nodeCount() == 1);
+
+    srand(49);
+    vector<vec2> input(20000);
+    for (auto& p : input) p = {rand() / (float)RAND_MAX * 200.0f - 100.0f, rand() / (float)RAND_MAX * 200.0f - 100.0f};
+    QuadTreeNode small(world);
+    QuadTreeNode<32, 12> big(world);
+    for (const vec2& p : input) {
+        small.insert(p);
+        big.insert(p);
+    }
+    cout << "nodes: capacity 3 -> " << small.nodeCount() << ", capacity 32 -> " << big.nodeCount() << endl;
+    assert(big.nodeCount() * 4 < small.nodeCount());
+
+    // visitor: 计数, 不分配
+    AABB rect{{-30, -10}, {40, 25}};
+    size_t cnt = 0;
+    bool finished = big.query(rect, [&](const vec2&) {
+        ++cnt;
+        return true;
+    });
+    hits.clear();
+    small.query(rect, hits);
+    assert(finished && cnt == hits.size());
+
+    // 提前结束: 只要范围内有没有点
+    size_t visited = 0;
+    finished = small.query(Circle{{0, 0}, 50.0f}, [&](const vec2&) {
+        ++visited;
+        return false;
+    });
+    assert(!finished && visited == 1);
+
+    // 找到 3 个就停
+    vector<vec2> firstThree;
+    big.query(rect, [&](const vec2& p) {
+        firstThree.push_back(p);
+        return firstThree.size() < 3;
+    });
+    assert(firstThree.size() == 3);
+    for (const vec2& p : firstThree) assert(rect.contains(p));
+    cout << "rect hits " << cnt << ", first three collected" << endl;
+}
+
+// SoA 叶子: 各种 Capacity 下查询结果和暴力一致, 包括刚好落在范围边上的点
+template <int Capacity>
+size_t checkLeafScan(const vector<vec2>& input, const vector<AABB>& rects, const vector<Circle>& circles) {
+    auto sorted = [](vector<vec2> v) {
+        sort(v.begin(), v.end(), [](const vec2& l, const vec2& r) { return l.x != r.x ? l.x < r.x : l.y < r.y; });
+        return v;
+    };
+    QuadTreeNode<Capacity, 12> qt(AABB{{-100, -100}, {100, 100}});
+    for (const vec2& p : input) qt.insert(p);
+
+    size_t hits = 0;
+    vector<vec2> got, expect;
+    for (const AABB& r : rects) {
+        got.clear(), expect.clear();
+        qt.query(r, got);
+        for (const vec2& p : input)
+            if (r.contains(p)) expect.push_back(p);
+        assert(sorted(got) == sorted(expect));
+        hits += got.size();
+    }
+    for (const Circle& c : circles) {
+        got.clear(), expect.clear();
+        qt.query(c, got);
+        for (const vec2& p : input)
+            if (c.contains(p)) expect.push_back(p);
+        assert(sorted(got) == sorted(expect));
+        hits += got.size();
+    }
+    return hits;
+}
+
+void subtest8() {
+    cout << __FUNCTION__ << endl;
+
+    srand(50);
+    vector<vec2> input;
+    // 整数格上的点, 范围的边也在整数上: 测 >= / <= 的边界
+    for (int i = 0; i < 3000; ++i) input.push_back({(float)(rand() % 201 - 100), (float)(rand() % 201 - 100)});
+    for (int i = 0; i < 7000; ++i) input.push_back({rand() / (float)RAND_MAX * 200.0f - 100.0f, rand() / (float)RAND_MAX * 200.0f - 100.0f});
+    vector<AABB> rects;
+    vector<Circle> circles;
+    for (int q = 0; q < 100; ++q) {
+        vec2 c{(float)(rand() % 200 - 100), (float)(rand() % 200 - 100)};
+        vec2 e{(float)(rand() % 30 + 1), (float)(rand() % 30 + 1)};
+        rects.push_back({c - e, c + e});
+        circles.push_back({c, e.x});
+    }
+    size_t h3 = checkLeafScan<3>(input, rects, circles);
+    size_t h13 = checkLeafScan<13>(input, rects, circles);  // 不是8的倍数, 最后一块不满
+    size_t h64 = checkLeafScan<64>(input, rects, circles);
+    assert(h3 == h13 && h3 == h64);
+    cout << "hits " << h3 << endl;
+
+#if RUN_QUAD_BENCH
+    // 叶子大小对查询时间的影响
+    input.clear();
+    for (int i = 0; i < 1000000; ++i) input.push_back({rand() / (float)RAND_MAX * 200.0f - 100.0f, rand() / (float)RAND_MAX * 200.0f - 100.0f});
+    auto bench = [&](auto tree) {
+        for (const vec2& p : input) tree.insert(p);
+        vector<vec2> out;
+        size_t total = 0;
+        auto t0 = chrono::steady_clock::now();
+        for (int rep = 0; rep < 10; ++rep)
+            for (const AABB& r : rects) {
+                out.clear();
+                tree.query(r, out);
+                total += out.size();
+            }
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+        cout << "nodes " << tree.nodeCount() << ", " << ms << " ms, hits " << total << endl;
+    };
+    bench(QuadTreeNode<3, 12>(AABB{{-100, -100}, {100, 100}}));
+    bench(QuadTreeNode<32, 12>(AABB{{-100, -100}, {100, 100}}));
+    bench(QuadTreeNode<128, 12>(AABB{{-100, -100}, {100, 100}}));
+#endif
+}
+
+// LooseQuadTree 里的物体长时间乱走: 空了的 node 回收, node 数不会一直涨
+void subtest9() {
+    cout << __FUNCTION__ << endl;
+
+    srand(49);
+    auto frand = [](float lo, float hi) { return lo + rand() / (float)RAND_MAX * (hi - lo); };
+    const int maxDepth = 8;
+    AABB world{{-100, -100}, {100, 100}};
+    LooseQuadTree<Circle> tree(world, maxDepth);
+    vector<uint32_t> handles;
+    vector<vec2> pos;
+    for (int i = 0; i < 500; ++i) {
+        pos.push_back({frand(-100, 100), frand(-100, 100)});
+        handles.push_back(tree.insert(Circle{pos.back(), 0.0f}));  // 半径 0, 在最深层
+    }
+    // 每个物体最多占一条 maxDepth 长的路径
+    const size_t bound = handles.size() * maxDepth + 1;
+    size_t peak = 0;
+    for (int frame = 0; frame < 400; ++frame) {
+        for (size_t i = 0; i < handles.size(); ++i) {
+            pos[i] = glm::clamp(pos[i] + vec2(frand(-2, 2), frand(-2, 2)), world.min, world.max);
+            tree.update(handles[i], Circle{pos[i], 0.0f});
+        }
+        peak = max(peak, tree.nodeCount());
+        assert(tree.nodeCount() <= bound);
+    }
+    vector<uint32_t> got;
+    tree.query(world, got);
+    assert(got.size() == handles.size());
+
+    for (uint32_t h : handles) tree.remove(h);
+    assert(tree.nodeCount() == 1);
+    cout << "objects " << handles.size() << ", peak nodes " << peak << " (bound " << bound << ")" << endl;
+}
+
+int cppMain() {
+    subtest1();
+    subtest2();
+    subtest3();
+    subtest4();
+    subtest5();
+    subtest6();
+    subtest7();
+    subtest8();
+    subtest9();
 
     return 0;
 }
@@ -253,38 +1617,53 @@ int cppMain() {
 /*===== Output =====
 
 [RUN  ] gfx_quad_tree
-adding new test here.
-Insert: (72, -80)
-Insert: (-95, 92)
-Insert: (68, 53)
-Insert: (4, 71)
-Insert: (-35, 17)
-Insert: (57, 6)
-Insert: (0, 20)
-Insert: (12, -14)
-Insert: (38, -45)
-Insert: (20, 19)
-Insert: (-40, -51)
-Insert: (-29, 93)
-Insert: (55, 49)
-Insert: (95, 83)
-Insert: (-80, -2)
-Insert: (81, -72)
-Insert: (57, -6)
-Insert: (44, -28)
-Insert: (93, -9)
-Insert: (88, 27)
-
-Rect hits: 3
-(0, 20)
-(20, 19)
-(12, -14)
-
-Circle hits: 3
-(0, 20)
-(20, 19)
-(12, -14)
-[tid=1] [Memory Report] globalNewCnt = 43, globalDeleteCnt = 43, globalNewMemSize = 3356, globalDeleteMemSize = 3356
+subtest1
+Insert: (-55, -34)
+Insert: (56, 57)
+Insert: (94, -49)
+Insert: (25, 18)
+Insert: (-32, -94)
+Insert: (94, -45)
+Insert: (-91, -95)
+Insert: (5, 51)
+Insert: (-77, 11)
+Insert: (-40, 58)
+Insert: (28, 91)
+Insert: (46, -98)
+Insert: (62, -50)
+Insert: (-96, -97)
+Insert: (57, -16)
+Insert: (-69, -98)
+Insert: (3, 88)
+Insert: (11, -3)
+Insert: (-61, 89)
+Insert: (67, -41)
+
+Rect hits: 1
+(11, -3)
+
+Circle hits: 1
+(11, -3)
+subtest2
+points 20000, nodes 6565, hits 441331
+memory: QuadTreeNode 3381816 bytes, LinearQuadTree 258472 bytes
+subtest3
+points 200000, nodes 78945
+subtest4
+nodes: 1885 -> 485 after removing 3/4
+subtest5
+3 nearest to origin: (0.835396, -0.968094) (1.41158, 0.456665) (-1.89283, 0.206223)
+subtest6
+levels: big box 1, small box 8, nodes 2738
+hits 86767, in-place updates 56459/60000
+subtest7
+nodes: capacity 3 -> 19613, capacity 32 -> 1373
+rect hits 1193, first three collected
+subtest8
+hits 39815
+subtest9
+objects 500, peak nodes 2204 (bound 4001)
+[tid=1] [Memory Report] globalNewCnt = 943068, globalDeleteCnt = 943068, globalNewMemSize = 153768116, globalDeleteMemSize = 153768116
 [   OK] gfx_quad_tree
 
 */
@@ -1,9 +1,39 @@
 #include <assert.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>  // rand
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 using namespace std;
 
+#include "aabb.h"
 #include "vec3.h"
 
 namespace gfx_tree {
@@ -75,6 +105,7 @@ follow-up:
         * 每次计算后将结果缓存
         * 只在 position 或 parent 变动后失效. 这里也不好处理, 如果祖父变动了，需要递归更新.
     2. 懒更新：只有 transform 改变时才更新全局位置（Push dirty down）
+    实现见 Node::updateWorld(), 每帧一次, 只走dirty的子树.
 4. 如何检测是否成环？Scene Tree 本质上不应该是 DAG 吗？
     * 场景树应该是 **一棵树**（有向无环图），不能成环
     * 但一旦通过 `addChild()` 加入了祖先节点，就可能构成环
@@ -378,21 +409,6 @@ void cullAndDraw(Node* n, const Frustum& fr) {
 需要我把这套代码整成一个最小可编译 demo（含 `vec3/mat4` 简易实现 + 随机树 + 裁剪统计）给你本地跑吗？
 */
 
-struct AABB {
-    vec3 min, max;
-    static AABB empty() {
-        return {vec3(+INFINITY), vec3(-INFINITY)};
-    }
-    static AABB fromMinMax(const vec3& mn, const vec3& mx) { return {mn, mx}; }
-    static AABB merge(const AABB& a, const AABB& b) {
-        return {
-            vec3(std::min(a.min.x, b.min.x), std::min(a.min.y, b.min.y), std::min(a.min.z, b.min.z)),
-            vec3(std::max(a.max.x, b.max.x), std::max(a.max.y, b.max.y), std::max(a.max.z, b.max.z))};
-    }
-
-    AABB translated(const vec3& t) const { return {min + t, max + t}; }
-};
-
 struct Transform {
     vec3 translation;
     // vec3 rotation;
@@ -411,6 +427,71 @@ struct Transform {
     // }
 };
 
+// 名字驻留 (interning): 每个不同的名字只存一份, 给一个连续的id.
+// 字符都放在大块的char数组里, 不是每个名字一个std::string, 块不会搬家, string_view一直有效.
+// 查找的时候hash一次字符串拿到id, 之后都用id, 比较和hash都是整数.
+using NameId = uint32_t;
+constexpr NameId INVALID_NAME = UINT32_MAX;
+
+class NameTable {
+public:
+    NameId intern(string_view s) {
+        auto it = ids.find(s);
+        if (it != ids.end()) return it->second;
+        char* p = alloc(s.size());
+        memcpy(p, s.data(), s.size());
+        string_view stored(p, s.size());
+        NameId id = NameId(strs.size());
+        strs.push_back(stored);
+        ids.emplace(stored, id);
+        return id;
+    }
+
+    // 没见过的名字返回INVALID_NAME, 不会插入.
+    NameId find(string_view s) const {
+        auto it = ids.find(s);
+        return it == ids.end() ? INVALID_NAME : it->second;
+    }
+
+    string_view str(NameId id) const { return strs[id]; }
+    size_t size() const { return strs.size(); }
+
+private:
+    static constexpr size_t CHUNK = 64 << 10;
+
+    char* alloc(size_t n) {
+        if (chunks.empty() || chunkUsed + n > chunkCap) {
+            chunkCap = std::max(CHUNK, n);
+            chunks.push_back(make_unique<char[]>(chunkCap));
+            chunkUsed = 0;
+        }
+        char* p = chunks.back().get() + chunkUsed;
+        chunkUsed += n;
+        return p;
+    }
+
+    vector<unique_ptr<char[]>> chunks;
+    size_t chunkUsed = 0;
+    size_t chunkCap = 0;
+    unordered_map<string_view, NameId> ids;
+    vector<string_view> strs;
+};
+
+class SceneIndex;
+
+// LOD组件: 一个模型的几个细节层级, level 0 最精细.
+// geometricError是这一级简化以后和原模型最大的偏差 (world space的长度), 越粗糙越大.
+struct LodLevel {
+    float geometricError;
+    int meshId;  // 真实引擎里是mesh/材质, 这里只是个标识
+};
+
+struct LodComponent {
+    vector<LodLevel> levels;  // 按geometricError从小到大
+    // 上一帧选的级别, 做hysteresis用. 选择是在只读的裁剪遍历里做的, 所以是mutable.
+    mutable int current = 0;
+};
+
 struct Node {
     string name;
     // 在父节点坐标系下的坐标(即父节点坐标的一个位移), 那么当前真正的坐标就是从root到当前节点所有的pos的累加.
@@ -420,6 +501,33 @@ struct Node {
 
     AABB localAABB = AABB::empty();  // 自几何, car在local space下的包围盒, 不包括子树
 
+    // 缓存, updateWorld()之后有效, 见下面的dirty flag部分.
+    vec3 worldT_cache = {0, 0, 0};
+    AABB worldAABB_cache = AABB::empty();
+    AABB worldAABB_aggregate_cache = AABB::empty();
+    // 自己的local transform变了 (或者换了父节点), 整棵子树的world transform都要重算.
+    bool transformDirty = true;
+    // 自己或者子树里有东西变了, 聚合AABB要重算. 保证: 一个节点dirty, 它的所有祖先也dirty.
+    bool boundsDirty = true;
+
+    // 上一帧把聚合AABB剔掉的平面, -1代表没有. 裁剪是只读遍历, 这个只是个缓存, 所以是mutable.
+    mutable int lastRejectPlane = -1;
+
+    // 可选的LOD组件, 没有就只有一个模型. 见下面的LOD部分.
+    unique_ptr<LodComponent> lod;
+
+    // 名字索引, 见SceneIndex. 挂在有索引的树上的时候有效.
+    SceneIndex* index = nullptr;
+    NameId nameId = INVALID_NAME;
+    Node* nextSameName = nullptr;  // 同名的节点串成双向链表, 删除O(1)
+    Node* prevSameName = nullptr;
+
+    // 子树节点个数 (包括自己), addChild的时候往上累加, 并行遍历时用来估计任务大小.
+    size_t subtreeCount = 1;
+
+    // 大场景的test关掉析构里的打印
+    inline static bool verboseDelete = true;
+
     // 构造函数
     Node(const std::string& name, const vec3& t) : name(name), transform(t) {}
 
@@ -434,10 +542,23 @@ struct Node {
     // 只有以下两种情况，不适合在析构里 delete children：
     // Node 并不拥有子节点，只是“观察者”或“共享者”（例如多个 parent 指向同一个 child）
     // 使用 shared_ptr / weak_ptr 管理资源，释放应交给引用计数管理
+    //
+    // 不递归: 很深的树 (比如一条链) 递归delete会爆栈. 孩子先从父节点上摘下来再delete, 就不会再往下递归了.
+    // 孩子倒着压栈, 删除顺序还是pre-order, 和递归的版本一样.
     ~Node() {
-        cout << "Deleting node: " << name << endl;
-        for (auto* child : children) {
-            delete child;
+        if (verboseDelete) {
+            cout << "Deleting node: " << name << endl;
+        }
+        // 整棵子树一次从索引里拿掉, 孩子析构的时候index已经是nullptr了.
+        if (index) indexDetach(this);
+        vector<Node*> stack(children.rbegin(), children.rend());
+        children.clear();
+        while (!stack.empty()) {
+            Node* n = stack.back();
+            stack.pop_back();
+            stack.insert(stack.end(), n->children.rbegin(), n->children.rend());
+            n->children.clear();
+            delete n;
         }
     }
 
@@ -446,6 +567,31 @@ struct Node {
         // 在加入孩子的时候就建立了父子关系, 把parent填上.
         child->parent = this;
         children.push_back(child);
+        // 换了父节点, world transform要重算. child本身可能已经是dirty的 (新建的),
+        // 所以从父节点开始往上标, 否则往上标到child就停了.
+        child->transformDirty = true;
+        child->boundsDirty = true;
+        markBoundsDirtyUpwards();
+        for (Node* n = this; n; n = n->parent) {
+            n->subtreeCount += child->subtreeCount;
+        }
+        if (index) indexAttach(child);
+    }
+
+    // 摘下一个孩子, 不delete, 所有权还给调用的人. 不是自己的孩子返回nullptr.
+    Node* removeChild(Node* child) {
+        auto it = find(children.begin(), children.end(), child);
+        if (it == children.end()) return nullptr;
+        children.erase(it);
+        if (child->index) indexDetach(child);
+        child->parent = nullptr;
+        child->transformDirty = true;
+        child->boundsDirty = true;
+        markBoundsDirtyUpwards();
+        for (Node* n = this; n; n = n->parent) {
+            n->subtreeCount -= child->subtreeCount;
+        }
+        return child;
     }
 
     // Part 3: 返回全局坐标
@@ -505,6 +651,85 @@ struct Node {
         }
         return agg;
     }
+
+    //=====================================================
+    // dirty flag
+    // 上面的getGlobalPosition_* / worldTranslation() 每次都走到root, 整个场景算一遍是O(N*depth),
+    // worldAABB_aggregate() 每次都算整棵子树.
+    // 改成缓存 + dirty flag:
+    //   setPosition/setLocalAABB/addChild 只打标记:
+    //       transformDirty 标在改动的节点上, 代表整棵子树的world transform要重算.
+    //       boundsDirty 往上标到root, 遇到已经dirty的就停, 所以均摊是O(1).
+    //   每帧在root上call一次updateWorld(), top-down只走dirty的子树, 干净的子树直接跳过.
+    //   之后 cachedWorld*() 直接返回缓存.
+
+    void setPosition(const vec3& p) {
+        transform.translation = p;
+        transformDirty = true;
+        markBoundsDirtyUpwards();
+    }
+
+    void setLocalAABB(const AABB& aabb) {
+        localAABB = aabb;
+        // 只影响自己的world AABB, 不影响孩子的transform.
+        markBoundsDirtyUpwards();
+    }
+
+    void markBoundsDirtyUpwards() {
+        for (Node* n = this; n && !n->boundsDirty; n = n->parent) {
+            n->boundsDirty = true;
+        }
+    }
+
+    // 在root上call. 返回重算了world transform的节点个数, 方便测试.
+    // parentChanged: 父节点的world transform这帧变了, 自己也要跟着变.
+    int updateWorld(bool parentChanged = false) {
+        bool changed = parentChanged || transformDirty;
+        // 整棵子树都是干净的
+        if (!changed && !boundsDirty) {
+            return 0;
+        }
+
+        int cnt = updateSelfWorld(changed);
+        for (auto* c : children) {
+            cnt += c->updateWorld(changed);
+        }
+        mergeChildrenBounds();
+        return cnt;
+    }
+
+    // updateWorld()拆成两半, 并行版本在中间把孩子分给别的线程.
+    // 前半: 只算自己, 返回1代表world transform重算了.
+    int updateSelfWorld(bool changed) {
+        int cnt = 0;
+        if (changed) {
+            worldT_cache = parent ? parent->worldT_cache + transform.translation : transform.translation;
+            transformDirty = false;
+            cnt++;
+        }
+        // boundsDirty 可能只是 setLocalAABB, transform没变, 自己的world AABB也要重算.
+        worldAABB_cache = localAABB.translated(worldT_cache);
+        return cnt;
+    }
+
+    // 后半: 孩子都算完了, 按孩子顺序合并聚合AABB.
+    void mergeChildrenBounds() {
+        AABB agg = worldAABB_cache;
+        for (auto* c : children) {
+            agg = AABB::merge(agg, c->worldAABB_aggregate_cache);
+        }
+        worldAABB_aggregate_cache = agg;
+        boundsDirty = false;
+    }
+
+    const vec3& cachedWorldTranslation() const { return worldT_cache; }
+    const AABB& cachedWorldAABB() const { return worldAABB_cache; }
+    const AABB& cachedWorldAABB_aggregate() const { return worldAABB_aggregate_cache; }
+
+private:
+    // SceneIndex在后面定义, 这两个也在后面实现.
+    void indexAttach(Node* subtree);
+    void indexDetach(Node* subtree);
 };
 
 Node* createNode(const string& name, const vec3& pos, vector<Node*> children = {}) {
@@ -515,6 +740,86 @@ Node* createNode(const string& name, const vec3& pos, vector<Node*> children = {
     return node;
 }
 
+//=========================================================
+// 名字 -> 节点的索引
+// 以前按名字找节点只能遍历整棵树比字符串 (见下面traverse里的debug代码).
+// SceneIndex: 名字驻留成NameId, heads[id]是这个名字的节点链表 (同名的用Node::nextSameName/prevSameName串起来), 查找和删除都是O(1).
+// 在root上attach()一次, 之后addChild/removeChild/delete自动维护, 不用手动同步.
+// 每帧要查很多次的 (gameplay/GIS), 先idOf()拿到NameId存起来, 之后find(id)只是一次数组访问.
+class SceneIndex {
+public:
+    SceneIndex() = default;
+    SceneIndex(const SceneIndex&) = delete;
+    SceneIndex& operator=(const SceneIndex&) = delete;
+    // 索引先没了的话, 节点里不能留着野指针
+    ~SceneIndex() {
+        for (Node* h : heads) {
+            for (Node* n = h; n;) {
+                Node* next = n->nextSameName;
+                n->index = nullptr;
+                n->nextSameName = n->prevSameName = nullptr;
+                n = next;
+            }
+        }
+    }
+
+    // 整棵子树加进来. 子树不能已经在别的索引里.
+    void attach(Node* subtree) {
+        vector<Node*> stack = {subtree};
+        while (!stack.empty()) {
+            Node* n = stack.back();
+            stack.pop_back();
+            assert(!n->index);
+            n->index = this;
+            n->nameId = names.intern(n->name);
+            if (heads.size() <= n->nameId) heads.resize(n->nameId + 1, nullptr);
+            n->prevSameName = nullptr;
+            n->nextSameName = heads[n->nameId];
+            if (n->nextSameName) n->nextSameName->prevSameName = n;
+            heads[n->nameId] = n;
+            count++;
+            stack.insert(stack.end(), n->children.begin(), n->children.end());
+        }
+    }
+
+    void detach(Node* subtree) {
+        vector<Node*> stack = {subtree};
+        while (!stack.empty()) {
+            Node* n = stack.back();
+            stack.pop_back();
+            assert(n->index == this);
+            // 很多节点同名 (mesh, lod0...) 的时候, 从头找要O(k), 删一棵子树就是平方
+            (n->prevSameName ? n->prevSameName->nextSameName : heads[n->nameId]) = n->nextSameName;
+            if (n->nextSameName) n->nextSameName->prevSameName = n->prevSameName;
+            n->nextSameName = n->prevSameName = nullptr;
+            n->index = nullptr;
+            count--;
+            stack.insert(stack.end(), n->children.begin(), n->children.end());
+        }
+    }
+
+    NameId idOf(string_view name) const { return names.find(name); }
+
+    // 同名的有好几个就返回其中一个, 都要的话用forEach.
+    Node* find(NameId id) const { return id < heads.size() ? heads[id] : nullptr; }
+    Node* find(string_view name) const { return find(idOf(name)); }
+
+    template <class F>
+    void forEach(NameId id, F&& f) const {
+        for (Node* n = find(id); n; n = n->nextSameName) f(n);
+    }
+
+    size_t size() const { return count; }
+
+private:
+    NameTable names;
+    vector<Node*> heads;
+    size_t count = 0;
+};
+
+void Node::indexAttach(Node* subtree) { index->attach(subtree); }
+void Node::indexDetach(Node* subtree) { subtree->index->detach(subtree); }
+
 void traverse(const Node* node, int level = 0) {
     if (node == nullptr) {
         return;
@@ -539,90 +844,2541 @@ void traverse(const Node* node, int level = 0) {
     }
 }
 
-void subtest1() {
-    cout << __FUNCTION__ << endl;
+//=========================================================
+// SceneStorage: data-oriented的scene graph
+/*
+上面的Node每个都是单独new出来的, children是vector<Node*>, 遍历的时候在heap里面到处跳, latency-bound.
+SceneStorage把所有节点放到连续的SoA数组里:
+    parent下标, local/world translation, local AABB, world AABB, aggregate AABB, flags, 各一个数组.
+    name是cold data, 单独放一个数组, 遍历的时候不会碰到.
+数组按DFS pre-order排好:
+    1, 父节点一定在孩子前面, world transform从前往后一次线性pass就算完 (算孩子的时候父节点已经算好了).
+    2, 每个子树在数组里是连续的一段 [i, i + subtreeSize[i]), 聚合AABB从后往前一次pass就能算完,
+       裁剪时整棵子树不可见就直接 i += subtreeSize[i] 跳过去, 还是顺序访问内存.
+Node*换成SceneHandle, 就是一个32bit id:
+    排序会改变节点在数组里的位置, 所以handle不直接用下标, 中间加一层 id -> 下标 的映射, 排序后handle依然有效.
+*/
 
-    cout << "build tree." << endl;
-    auto root =
-        // l0
-        createNode("root", vec3(0, 0, 0), {
-                                              // l1
-                                              createNode("1", vec3(1, 2, 3), {
-                                                                                 // l2
-                                                                                 createNode("2", vec3(4, 5, 6), {}),
-                                                                                 createNode("3", vec3(7, 8, 9), {}),
-                                                                                 createNode("4", vec3(10, 11, 12), {}),
-                                                                             }),
-                                              createNode("5", vec3(4, 5, 6), {
-                                                                                 createNode("6", vec3(4, 5, 6), {}),
-                                                                                 createNode("7", vec3(7, 8, 9), {}),
-                                                                                 createNode("8", vec3(10, 11, 12), {}),
-                                                                             }),
-                                              createNode("9", vec3(7, 8, 9), {
-                                                                                 createNode("10", vec3(4, 5, 6), {}),
-                                                                                 createNode("11", vec3(7, 8, 9), {}),
-                                                                                 createNode("12", vec3(10, 11, 12), {}),
-                                                                             }),
-                                              createNode("13", vec3(10, 11, 12), {
-                                                                                     createNode("14", vec3(4, 5, 6), {}),
-                                                                                     createNode("15", vec3(7, 8, 9), {}),
-                                                                                     createNode("16", vec3(10, 11, 12), {}),
-                                                                                 }),
-                                          });
+struct SceneHandle {
+    uint32_t id = UINT32_MAX;
+    bool valid() const { return id != UINT32_MAX; }
+};
 
-    // root->print();
+// 一帧里的变换修改先攒起来, 最后一次SceneStorage::applyBatch(). 同一个节点改多次, 最后一次算数.
+class TransformBatch {
+public:
+    void setLocalTranslation(SceneHandle h, const vec3& t) { edits.push_back({h.id, t}); }
+    size_t size() const { return edits.size(); }
+    void clear() { edits.clear(); }
 
-    cout << "traverse tree." << endl;
-    traverse(root);
+private:
+    friend class SceneStorage;
+    vector<pair<uint32_t, vec3>> edits;  // handle id, 新的local translation
+};
 
-    delete root;
+class SceneStorage {
+public:
+    static constexpr uint32_t INVALID = UINT32_MAX;
+
+    enum Flags : uint8_t {
+        FLAG_NONE = 0,
+        FLAG_HAS_GEOMETRY = 1 << 0,  // localAABB不是empty
+    };
+
+    size_t size() const { return parent.size(); }
+
+    // 父节点必须已经存在, 所以新节点一定在父节点后面, 父在子前这个条件自动满足.
+    // 但是不一定是pre-order, 用之前updateWorld()会自动重新排序.
+    SceneHandle create(const string& name, const vec3& t, SceneHandle parentHandle = {}) {
+        uint32_t idx = (uint32_t)size();
+        SceneHandle h{(uint32_t)indexOfId.size()};
+        indexOfId.push_back(idx);
+        idOfIndex.push_back(h.id);
+
+        parent.push_back(parentHandle.valid() ? indexOfId[parentHandle.id] : INVALID);
+        localT.push_back(t);
+        localAABB.push_back(AABB::empty());
+        for (auto& w : buf) {
+            w.worldT.push_back(t);
+            w.worldAABB.push_back(AABB::empty());
+            w.aggAABB.push_back(AABB::empty());
+        }
+        subtreeSize.push_back(1);
+        flags.push_back(FLAG_NONE);
+        names.push_back(name);
+
+        // 只有是父节点的最后一个子树末尾的时候才还是pre-order, 简单起见统一标记.
+        orderDirty = true;
+        return h;
+    }
+
+    // 从指针版本的Node树转过来, 直接按DFS pre-order加入, 不用再排序.
+    static SceneStorage fromTree(const Node* root) {
+        SceneStorage s;
+        s.appendSubtree(root, {});
+        s.sortHierarchy();
+        return s;
+    }
+
+    void setLocalTranslation(SceneHandle h, const vec3& t) { localT[indexOfId[h.id]] = t; }
+    void setLocalAABB(SceneHandle h, const AABB& b) {
+        uint32_t i = indexOfId[h.id];
+        localAABB[i] = b;
+        flags[i] = b.isEmpty() ? (flags[i] & ~FLAG_HAS_GEOMETRY) : (flags[i] | FLAG_HAS_GEOMETRY);
+    }
+
+    // 换父节点, 可能破坏父在子前的顺序, 标记一下, 下次updateWorld前重排.
+    void setParent(SceneHandle h, SceneHandle newParent) {
+        uint32_t i = indexOfId[h.id];
+        uint32_t p = newParent.valid() ? indexOfId[newParent.id] : INVALID;
+        // 不能成环: 新父节点不能在当前节点的子树里
+        for (uint32_t a = p; a != INVALID; a = parent[a]) {
+            assert(a != i && "Cycle detected in scene graph!");
+        }
+        parent[i] = p;
+        orderDirty = true;
+    }
+
+    const string& name(SceneHandle h) const { return names[indexOfId[h.id]]; }
+    SceneHandle parentOf(SceneHandle h) const {
+        uint32_t p = parent[indexOfId[h.id]];
+        return p == INVALID ? SceneHandle{} : SceneHandle{idOfIndex[p]};
+    }
+    const vec3& localTranslation(SceneHandle h) const { return localT[indexOfId[h.id]]; }
+    // 下面几个是updateWorld()/applyBatch()的结果, 模拟线程这边看到的 (back buffer).
+    const vec3& worldTranslation(SceneHandle h) const { return buf[back].worldT[indexOfId[h.id]]; }
+    const AABB& worldAABB_self(SceneHandle h) const { return buf[back].worldAABB[indexOfId[h.id]]; }
+    const AABB& worldAABB_aggregate(SceneHandle h) const { return buf[back].aggAABB[indexOfId[h.id]]; }
+
+    // 每帧一次: 从前往后算world transform和自己的world AABB, 从后往前合并聚合AABB.
+    void updateWorld() {
+        if (orderDirty) {
+            sortHierarchy();
+        }
+        WorldState& w = buf[back];
+        const size_t n = size();
+        for (size_t i = 0; i < n; ++i) {
+            uint32_t p = parent[i];
+            w.worldT[i] = (p == INVALID) ? localT[i] : w.worldT[p] + localT[i];
+            w.worldAABB[i] = localAABB[i].translated(w.worldT[i]);
+            w.aggAABB[i] = w.worldAABB[i];
+        }
+        // 孩子都在父节点后面, 倒着走的时候孩子的聚合AABB已经完整了.
+        for (size_t i = n; i-- > 0;) {
+            uint32_t p = parent[i];
+            if (p != INVALID) {
+                w.aggAABB[p] = AABB::merge(w.aggAABB[p], w.aggAABB[i]);
+            }
+        }
+        curFull = true;
+    }
+
+    //=====================================================
+    // 批量变换更新 + 双缓冲
+    // 每次setPosition都马上往上标dirty, 一帧改5万个物体就要往上走5万次, 很多祖先被重复走.
+    // applyBatch(): 一帧的修改一起处理:
+    //   1, 按数组下标 (pre-order) 排序去重. 前面改过的节点的子树是连续的一段, 落在里面的修改不用单独处理.
+    //   2, 每个改动的子树 [i, i + subtreeSize[i]) 从前往后重算world, 从后往前合并聚合AABB.
+    //   3, 祖先的聚合AABB: 往上走的时候打标记, 碰到已经标过的就停, 每个祖先只收集一次,
+    //      最后按下标从大到小 (孩子在前) 一次pass重算.
+    // 双缓冲: world state (worldT, worldAABB, aggAABB) 有两份.
+    //   模拟线程写back, 渲染/裁剪线程读front (上一次publish()的那一帧), 读写不是同一份内存, 不用锁.
+    //   publish()在帧边界交换 (这时候没有人在读front, 由引擎的帧同步保证).
+    //   交换以后新的back是两帧以前的状态, 还差上一帧的修改, 下一次applyBatch()把上一帧改过的下标一起重算.
+    //   这一帧没有applyBatch()的话, publish()交换之前先把上一帧的修改补到back上.
+    // 结构变化 (create, setParent, sortHierarchy) 两份都会改, 只能在帧边界做.
+
+    // 返回重算了world transform的节点数.
+    size_t applyBatch(const TransformBatch& batch) {
+        if (orderDirty) {
+            sortHierarchy();
+        }
+        vector<uint32_t> idx;
+        idx.reserve(batch.edits.size());
+        for (auto& [id, t] : batch.edits) {
+            uint32_t i = indexOfId[id];
+            localT[i] = t;  // 后写的覆盖先写的
+            idx.push_back(i);
+        }
+        sort(idx.begin(), idx.end());
+        idx.erase(unique(idx.begin(), idx.end()), idx.end());
+
+        // 这一帧改过哪些, publish()以后另一份要补上
+        vector<uint32_t> merged;
+        set_union(curChange.begin(), curChange.end(), idx.begin(), idx.end(), back_inserter(merged));
+        curChange.swap(merged);
+        return catchUp(idx);
+    }
+
+    // 帧边界调用: 刚写好的back变成front给读的线程.
+    void publish() {
+        // 没有修改的帧: back还差上一帧的修改, 直接交换的话front会退回两帧以前
+        if (prevFull || !prevChange.empty()) catchUp({});
+        back ^= 1;
+        prevFull = curFull;
+        prevChange.swap(curChange);
+        curChange.clear();
+        curFull = false;
+    }
+
+    // 读的线程用这几个, 读的是上一次publish()的结果.
+    const vec3& frontWorldTranslation(SceneHandle h) const { return buf[back ^ 1].worldT[indexOfId[h.id]]; }
+    const AABB& frontWorldAABB_aggregate(SceneHandle h) const { return buf[back ^ 1].aggAABB[indexOfId[h.id]]; }
+
+    // 对front做视锥裁剪, pre-order, 和cullAndDraw一样.
+    void cullFront(const Frustum& fr, vector<SceneHandle>& out) const {
+        assert(!orderDirty);
+        const WorldState& w = buf[back ^ 1];
+        for (size_t i = 0; i < size();) {
+            if (!aabbInsideFrustum(w.aggAABB[i], fr)) {
+                i += subtreeSize[i];
+                continue;
+            }
+            if (aabbInsideFrustum(w.worldAABB[i], fr)) out.push_back(SceneHandle{idOfIndex[i]});
+            ++i;
+        }
+    }
+
+    // 按pre-order访问, visit返回false就跳过整棵子树.
+    template <typename Fn>
+    void traverse(Fn&& visit) const {
+        assert(!orderDirty);
+        for (size_t i = 0; i < size();) {
+            if (visit(SceneHandle{idOfIndex[i]})) {
+                ++i;
+            } else {
+                i += subtreeSize[i];
+            }
+        }
+    }
+
+    // 重新按DFS pre-order排好所有数组, 同时算出每个节点的subtreeSize. O(n).
+    void sortHierarchy() {
+        const uint32_t n = (uint32_t)size();
+
+        // 先建临时的child链表 (first child / next sibling), 保持原来的孩子顺序.
+        vector<uint32_t> firstChild(n, INVALID), nextSibling(n, INVALID), lastChild(n, INVALID);
+        vector<uint32_t> roots;
+        for (uint32_t i = 0; i < n; ++i) {
+            uint32_t p = parent[i];
+            if (p == INVALID) {
+                roots.push_back(i);
+            } else if (lastChild[p] == INVALID) {
+                firstChild[p] = lastChild[p] = i;
+            } else {
+                nextSibling[lastChild[p]] = i;
+                lastChild[p] = i;
+            }
+        }
+
+        // 迭代DFS, 不用递归, 深的链也不会爆栈. order[newIdx] = oldIdx
+        vector<uint32_t> order;
+        order.reserve(n);
+        vector<uint32_t> stk;
+        for (auto it = roots.rbegin(); it != roots.rend(); ++it) stk.push_back(*it);
+        while (!stk.empty()) {
+            uint32_t cur = stk.back();
+            stk.pop_back();
+            order.push_back(cur);
+            // 孩子倒序入栈, 出栈就是正序
+            vector<uint32_t>::size_type mark = stk.size();
+            for (uint32_t c = firstChild[cur]; c != INVALID; c = nextSibling[c]) stk.push_back(c);
+            reverse(stk.begin() + mark, stk.end());
+        }
+        assert(order.size() == n);
+
+        vector<uint32_t> newIndex(n);
+        for (uint32_t i = 0; i < n; ++i) newIndex[order[i]] = i;
+
+        auto permute = [&](auto& arr) {
+            auto old = move(arr);
+            arr.resize(n);
+            for (uint32_t i = 0; i < n; ++i) arr[i] = move(old[order[i]]);
+        };
+        permute(parent);
+        for (auto& p : parent) {
+            if (p != INVALID) p = newIndex[p];
+        }
+        permute(localT);
+        permute(localAABB);
+        for (auto& w : buf) {
+            permute(w.worldT);
+            permute(w.worldAABB);
+            permute(w.aggAABB);
+        }
+        permute(flags);
+        permute(names);
+        permute(idOfIndex);
+        for (uint32_t i = 0; i < n; ++i) indexOfId[idOfIndex[i]] = i;
+
+        // pre-order下倒着累加就是子树大小
+        subtreeSize.assign(n, 1);
+        for (uint32_t i = n; i-- > 0;) {
+            if (parent[i] != INVALID) subtreeSize[parent[i]] += subtreeSize[i];
+        }
+        orderDirty = false;
+        // 下标都变了, 记下来的修改列表没用了
+        prevFull = curFull = true;
+        prevChange.clear();
+        curChange.clear();
+    }
+
+private:
+    struct WorldState {
+        vector<vec3> worldT;
+        vector<AABB> worldAABB;  // 自己的world AABB, 不含子树
+        vector<AABB> aggAABB;    // 自己 + 子树
+    };
+
+    // 把上一帧的修改补到back上, 和这一帧的idx (排好序的下标) 一起重算. 返回重算的节点数.
+    size_t catchUp(const vector<uint32_t>& idx) {
+        if (prevFull) {
+            // 另一份差的太多 (整个重算过或者重排过), 整个重算. 这是补上一帧的, 不算这一帧的修改.
+            bool wasFull = curFull;
+            updateWorld();
+            curFull = wasFull;
+            prevFull = false;
+            prevChange.clear();
+            return size();
+        }
+        // 上一帧的修改back还没有, 一起算
+        vector<uint32_t> todo;
+        set_union(prevChange.begin(), prevChange.end(), idx.begin(), idx.end(), back_inserter(todo));
+        prevChange.clear();
+        return recompute(todo);
+    }
+
+    // todo: 排好序的下标. 见applyBatch().
+    size_t recompute(const vector<uint32_t>& todo) {
+        WorldState& w = buf[back];
+        if (mark.size() < size()) mark.resize(size(), 0);
+        ++epoch;
+        size_t cnt = 0;
+        uint32_t coveredEnd = 0;
+        vector<uint32_t> ancestors;
+        for (uint32_t i : todo) {
+            // 在前面重算过的子树里面
+            if (i < coveredEnd) continue;
+            uint32_t end = i + subtreeSize[i];
+            for (uint32_t j = i; j < end; ++j) {
+                uint32_t p = parent[j];
+                w.worldT[j] = (p == INVALID) ? localT[j] : w.worldT[p] + localT[j];
+                w.worldAABB[j] = localAABB[j].translated(w.worldT[j]);
+                w.aggAABB[j] = w.worldAABB[j];
+            }
+            for (uint32_t j = end; j-- > i + 1;) {
+                w.aggAABB[parent[j]] = AABB::merge(w.aggAABB[parent[j]], w.aggAABB[j]);
+            }
+            cnt += end - i;
+            coveredEnd = end;
+            for (uint32_t a = parent[i]; a != INVALID && mark[a] != epoch; a = parent[a]) {
+                mark[a] = epoch;
+                ancestors.push_back(a);
+            }
+        }
+        // 下标大的先算, 孩子一定在父节点前面算好
+        sort(ancestors.begin(), ancestors.end(), greater<uint32_t>());
+        for (uint32_t a : ancestors) {
+            AABB agg = w.worldAABB[a];
+            for (uint32_t c = a + 1; c < a + subtreeSize[a]; c += subtreeSize[c]) {
+                agg = AABB::merge(agg, w.aggAABB[c]);
+            }
+            w.aggAABB[a] = agg;
+        }
+        return cnt;
+    }
+
+    void appendSubtree(const Node* node, SceneHandle parentHandle) {
+        SceneHandle h = create(node->name, node->transform.translation, parentHandle);
+        setLocalAABB(h, node->localAABB);
+        for (auto* c : node->children) {
+            appendSubtree(c, h);
+        }
+    }
+
+    // hot data, 按pre-order排好
+    vector<uint32_t> parent;  // 父节点的下标, root是INVALID
+    vector<vec3> localT;      // local translation, 和Node::transform一样只有平移
+    vector<AABB> localAABB;
+    WorldState buf[2];  // 双缓冲, buf[back]是模拟线程在写的
+    int back = 0;
+    vector<uint32_t> subtreeSize;
+    vector<uint8_t> flags;
+
+    // cold data
+    vector<string> names;
+
+    // handle id <-> 数组下标
+    vector<uint32_t> indexOfId;
+    vector<uint32_t> idOfIndex;
+
+    bool orderDirty = false;
+
+    // 这一帧/上一帧改过的下标 (排好序), Full代表整个重算过
+    vector<uint32_t> curChange, prevChange;
+    bool curFull = false, prevFull = true;
+    // 收集祖先时去重用
+    vector<uint32_t> mark;
+    uint32_t epoch = 0;
+};
+
+//=========================================================
+// 二进制场景文件, mmap进来原地使用
+// 现在场景都是代码里createNode建的, 大地图一个节点一个节点new要好几秒.
+// 存成扁平的数组: 不用解析, 不用拷贝, mmap以后指针直接指到文件内容上, 哪页用到了OS才读进来.
+// 布局 (小端, 各段16字节对齐):
+//   SceneFileHeader
+//   SceneFileNode nodes[nodeCount]  pre-order, 一棵子树是连续的一段, 跳过子树 = 跳过subtreeSize个
+//   char strings[stringBytes]       名字表, 每个名字以'\0'结尾
+// 包围盒是写文件的时候算好的, 读进来直接可以裁剪. 视锥外的子树整段跳过, 它们的页根本不会被读.
+constexpr uint32_t SCENE_FILE_VERSION = 1;
+constexpr char SCENE_FILE_MAGIC[8] = {'L', 'C', 'S', 'C', 'E', 'N', 'E', 0};
+
+struct SceneFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nodeCount;
+    uint64_t nodesOffset;
+    uint64_t stringsOffset;
+    uint64_t stringBytes;
+    uint64_t fileSize;
+};
+
+// 不用vec3/AABB, 文件格式不跟着代码里的类型变.
+struct SceneFileNode {
+    uint32_t parent;       // 文件里的下标, root是UINT32_MAX
+    uint32_t subtreeSize;  // 包括自己
+    uint32_t nameOffset;   // 在strings里的偏移
+    uint32_t nameLength;
+    float localT[3];
+    float selfMin[3], selfMax[3];  // 自己的world AABB
+    float aggMin[3], aggMax[3];    // 聚合
+    uint32_t pad;
+};
+static_assert(sizeof(SceneFileNode) == 80, "SceneFileNode layout changed, bump SCENE_FILE_VERSION");
+static_assert(is_trivially_copyable_v<SceneFileNode> && is_trivially_copyable_v<SceneFileHeader>);
+
+inline uint64_t alignUp16(uint64_t x) { return (x + 15) & ~uint64_t(15); }
+
+// 整个SceneStorage写成一个文件, 只能有一个root. 要先updateWorld(). 写不进去返回false.
+bool writeSceneFile(const string& path, const SceneStorage& scene) {
+    // pre-order重新编号
+    vector<SceneHandle> order;
+    vector<uint32_t> fileIndex(scene.size(), UINT32_MAX);
+    size_t roots = 0;
+    scene.traverse([&](SceneHandle h) {
+        fileIndex[h.id] = uint32_t(order.size());
+        order.push_back(h);
+        roots += !scene.parentOf(h).valid();
+        return true;
+    });
+    if (roots != 1) return false;
+
+    vector<SceneFileNode> nodes(order.size());
+    string strings;
+    auto put3 = [](float dst[3], const vec3& v) {
+        dst[0] = v.x;
+        dst[1] = v.y;
+        dst[2] = v.z;
+    };
+    for (size_t i = 0; i < order.size(); ++i) {
+        SceneHandle h = order[i];
+        SceneHandle p = scene.parentOf(h);
+        const string& name = scene.name(h);
+        SceneFileNode& fn = nodes[i];
+        fn = {};
+        fn.parent = p.valid() ? fileIndex[p.id] : UINT32_MAX;
+        fn.subtreeSize = 1;
+        fn.nameOffset = uint32_t(strings.size());
+        fn.nameLength = uint32_t(name.size());
+        strings += name;
+        strings += '\0';
+        put3(fn.localT, scene.localTranslation(h));
+        put3(fn.selfMin, scene.worldAABB_self(h).min);
+        put3(fn.selfMax, scene.worldAABB_self(h).max);
+        put3(fn.aggMin, scene.worldAABB_aggregate(h).min);
+        put3(fn.aggMax, scene.worldAABB_aggregate(h).max);
+    }
+    // pre-order里孩子在父节点后面, 倒着累加就是子树大小
+    for (size_t i = nodes.size(); i-- > 1;) nodes[nodes[i].parent].subtreeSize += nodes[i].subtreeSize;
+
+    SceneFileHeader h = {};
+    memcpy(h.magic, SCENE_FILE_MAGIC, sizeof(h.magic));
+    h.version = SCENE_FILE_VERSION;
+    h.nodeCount = uint32_t(nodes.size());
+    h.nodesOffset = alignUp16(sizeof(h));
+    h.stringsOffset = alignUp16(h.nodesOffset + nodes.size() * sizeof(SceneFileNode));
+    h.stringBytes = strings.size();
+    h.fileSize = h.stringsOffset + h.stringBytes;
+
+    ofstream f(path, ios::binary | ios::trunc);
+    if (!f) return false;
+    const char zeros[16] = {};
+    f.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    f.write(zeros, h.nodesOffset - sizeof(h));
+    f.write(reinterpret_cast<const char*>(nodes.data()), nodes.size() * sizeof(SceneFileNode));
+    f.write(zeros, h.stringsOffset - (h.nodesOffset + nodes.size() * sizeof(SceneFileNode)));
+    f.write(strings.data(), strings.size());
+    return bool(f);
 }
 
-void subtest2() {
-    cout << __FUNCTION__ << endl;
+// 只读映射一个文件, POSIX用mmap, Windows用MapViewOfFile.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const string& path) {
+        close();
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER sz;
+        HANDLE mapping = nullptr;
+        if (GetFileSizeEx(file, &sz) && sz.QuadPart > 0) {
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        }
+        CloseHandle(file);  // mapping自己持有文件
+        if (!mapping) return false;
+        data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        CloseHandle(mapping);  // view自己持有mapping
+        if (!data) return false;
+        bytes = size_t(sz.QuadPart);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        void* p = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        ::close(fd);  // 映射自己持有文件
+        if (p == MAP_FAILED) return false;
+        data = static_cast<const uint8_t*>(p);
+        bytes = size_t(st.st_size);
+#endif
+        return true;
+    }
 
-    // 假设场景是world里面有一个code car, 只有一个node wheel (单轮车), car和wheel的AABB有overlap, 但是不是包围关系.
-    // World (root)
-    //   └─ Car (Node)
-    //     └─ Wheel (Node)
+    void close() {
+        if (!data) return;
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+#else
+        munmap(const_cast<uint8_t*>(data), bytes);
+#endif
+        data = nullptr;
+        bytes = 0;
+    }
 
-    auto root = new Node("root", {0, 0, 0});
+    // 提示OS这一段马上要用, 提前读进来. 只是提示, 不支持就什么都不做.
+    void willNeed(size_t offset, size_t len) const {
+#ifndef _WIN32
+        const size_t page = size_t(sysconf(_SC_PAGESIZE));
+        size_t begin = offset / page * page;
+        madvise(const_cast<uint8_t*>(data) + begin, offset + len - begin, MADV_WILLNEED);
+#else
+        (void)offset;
+        (void)len;
+#endif
+    }
 
-    auto car = new Node("car", {5, 0, 0});                       // 位置（相对 World）：(5, 0, 0)
-    car->localAABB = AABB::fromMinMax({-1, -1, -2}, {1, 1, 2});  // 假设车的模型长 2m、宽 2m、高 4m
+    const uint8_t* begin() const { return data; }
+    size_t size() const { return bytes; }
 
-    auto wheel = new Node("wheel", {1, -1, 0});                                      // 位置（相对 Car）：(1, -1, 0)
-    wheel->localAABB = AABB::fromMinMax({-0.5f, -0.5f, -0.5f}, {0.5f, 0.5f, 0.5f});  // 轮子直径 1m、宽 1m、厚 1m
+private:
+    const uint8_t* data = nullptr;
+    size_t bytes = 0;
+};
 
-    root->addChild(car);
-    car->addChild(wheel);
+// mmap进来的场景, 所有访问都直接读映射的内存.
+class MappedScene {
+public:
+    // 文件不对 (magic, 版本, 大小, 节点记录) 返回false.
+    bool open(const string& path) {
+        hdr = nullptr;
+        if (!file.open(path)) return false;
+        if (file.size() < sizeof(SceneFileHeader)) return false;
+        const auto* h = reinterpret_cast<const SceneFileHeader*>(file.begin());
+        if (memcmp(h->magic, SCENE_FILE_MAGIC, sizeof(h->magic)) != 0) return false;
+        if (h->version != SCENE_FILE_VERSION) return false;
+        if (h->fileSize != file.size()) return false;
+        // 头里的偏移和长度不可信, 都用减法比较, 两个uint64相加会溢出绕回来
+        if (h->nodesOffset < sizeof(SceneFileHeader) || h->nodesOffset % 16) return false;
+        if (h->nodesOffset > h->stringsOffset || h->stringsOffset > h->fileSize) return false;
+        if (h->nodeCount > (h->stringsOffset - h->nodesOffset) / sizeof(SceneFileNode)) return false;
+        if (h->stringBytes > h->fileSize - h->stringsOffset) return false;
+        const auto* arr = reinterpret_cast<const SceneFileNode*>(file.begin() + h->nodesOffset);
+        if (!validNodes(arr, h->nodeCount, h->stringBytes)) return false;
+        hdr = h;
+        nodeArr = arr;
+        strings = reinterpret_cast<const char*>(file.begin() + h->stringsOffset);
+        return true;
+    }
 
-    AABB sceneBox = root->worldAABB_aggregate();  // 面试展示：聚合包围盒
-    assert(sceneBox.min == vec3(4, -1.5, -2) && sceneBox.max == vec3(6.5, 1, 2));
+    void close() {
+        file.close();
+        hdr = nullptr;
+    }
 
-    delete root;
+    size_t size() const { return hdr ? hdr->nodeCount : 0; }
+    const SceneFileNode& node(uint32_t i) const { return nodeArr[i]; }
+    string_view name(uint32_t i) const { return {strings + nodeArr[i].nameOffset, nodeArr[i].nameLength}; }
+    vec3 localTranslation(uint32_t i) const { return toVec3(nodeArr[i].localT); }
+    AABB worldAABB_self(uint32_t i) const { return AABB::fromMinMax(toVec3(nodeArr[i].selfMin), toVec3(nodeArr[i].selfMax)); }
+    AABB worldAABB_aggregate(uint32_t i) const {
+        return AABB::fromMinMax(toVec3(nodeArr[i].aggMin), toVec3(nodeArr[i].aggMax));
+    }
+
+    // 子树i马上要用 (比如相机快到了), 让OS先把它的页读进来.
+    void prefetchSubtree(uint32_t i) const {
+        file.willNeed(hdr->nodesOffset + size_t(i) * sizeof(SceneFileNode), nodeArr[i].subtreeSize * sizeof(SceneFileNode));
+    }
+
+    // 和cullAndDraw结果一样, pre-order. 不用递归, 视锥外的子树直接跳过subtreeSize个节点.
+    void cull(const Frustum& fr, vector<uint32_t>& out) const {
+        uint32_t n = uint32_t(size());
+        for (uint32_t i = 0; i < n;) {
+            if (!aabbInsideFrustum(worldAABB_aggregate(i), fr)) {
+                i += nodeArr[i].subtreeSize;
+                continue;
+            }
+            if (aabbInsideFrustum(worldAABB_self(i), fr)) out.push_back(i);
+            i++;
+        }
+    }
+
+private:
+    static vec3 toVec3(const float v[3]) { return {v[0], v[1], v[2]}; }
+
+    // 映射进来直接用, 不解析, 所以打开时要把每条记录检查一遍, 否则坏文件会让后面越界或死循环:
+    //   subtreeSize为0, cull跳不动; parent/name越界, loadSubtreeFromFile和name()读到外面去.
+    // pre-order: 除了root, parent在前面, 而且自己落在parent的子树范围里.
+    static bool validNodes(const SceneFileNode* arr, uint32_t count, uint64_t stringBytes) {
+        for (uint32_t i = 0; i < count; ++i) {
+            const SceneFileNode& fn = arr[i];
+            if (fn.subtreeSize < 1 || fn.subtreeSize > count - i) return false;
+            if (i == 0) {
+                if (fn.parent != UINT32_MAX) return false;
+            } else if (fn.parent >= i || uint64_t(i) >= uint64_t(fn.parent) + arr[fn.parent].subtreeSize) {
+                return false;
+            }
+            if (uint64_t(fn.nameOffset) + fn.nameLength > stringBytes) return false;
+        }
+        return true;
+    }
+
+    MappedFile file;
+    const SceneFileHeader* hdr = nullptr;
+    const SceneFileNode* nodeArr = nullptr;
+    const char* strings = nullptr;
+};
+
+//=========================================================
+// 视锥裁剪, 用updateWorld()之后缓存的聚合AABB.
+// 聚合AABB不在视锥内, 整棵子树跳过. draw就是把节点放到out里面, pre-order.
+// planeTests: 可选, 统计做了多少次平面测试.
+void cullAndDraw(const Node* n, const Frustum& fr, vector<const Node*>& out, size_t* planeTests = nullptr) {
+    if (!n) return;
+    if (!aabbInsideFrustum(n->cachedWorldAABB_aggregate(), fr, planeTests)) return;  // 剪掉整棵
+    // 子树可能可见, 再用自己的AABB精细判断
+    if (aabbInsideFrustum(n->cachedWorldAABB(), fr, planeTests)) {
+        out.push_back(n);
+    }
+    for (auto* c : n->children) cullAndDraw(c, fr, out, planeTests);
 }
 
-int cppMain() {
-    subtest1();
-    subtest2();
+//=========================================================
+// 上面的cullAndDraw每个节点都要测6个平面, 优化:
+// 1, plane mask继承: 父节点的聚合AABB已经完全在某个平面里面, 孩子肯定也在, 不用测.
+//    mask往下传, 变成0的时候整棵子树都在视锥里, 不用测直接全部收下.
+// 2, coherency: 每个节点记住上一帧是哪个平面把它剔掉的, 这一帧先测那个平面.
+//    相机是连续移动的, 上一帧在左平面外面的东西, 这一帧大概率还在左平面外面, 测一次就结束.
+// 结果和cullAndDraw完全一样, 只是平面测试少很多. 细节见aabb.h的cullPlanes.
+
+// 整棵子树都在视锥里面, 不用测了, 有几何的节点全部收下.
+void acceptSubtree(const Node* n, vector<const Node*>& out) {
+    if (!n->cachedWorldAABB().isEmpty()) {
+        out.push_back(n);
+    }
+    for (auto* c : n->children) acceptSubtree(c, out);
+}
 
-    return 0;
+void cullAndDraw_masked(const Node* n, const Frustum& fr, vector<const Node*>& out,
+                        uint32_t mask = CULL_ALL_PLANES, size_t* planeTests = nullptr) {
+    if (!n) return;
+    uint32_t m = mask ? cullPlanes(n->cachedWorldAABB_aggregate(), fr, mask, n->lastRejectPlane, planeTests) : 0;
+    if (m == CULL_OUTSIDE) return;
+    if (m == 0) {
+        acceptSubtree(n, out);
+        return;
+    }
+    // 自己的AABB在聚合AABB里面, 用聚合AABB剩下的mask测就够了. 这里不用缓存.
+    int selfReject = -1;
+    if (cullPlanes(n->cachedWorldAABB(), fr, m, selfReject, planeTests) != CULL_OUTSIDE) {
+        out.push_back(n);
+    }
+    for (auto* c : n->children) cullAndDraw_masked(c, fr, out, m, planeTests);
 }
 
-}  // namespace gfx_tree
+//=========================================================
+// 多视锥裁剪: 主相机, 几个shadow cascade, reflection probe都要裁同一个场景.
+// 每个视锥单独走一遍cullAndDraw, 层次结构要从内存里读N遍.
+// 这里一次遍历处理所有视锥, viewMask的bit v代表这棵子树对视锥v可能可见,
+// 每个视锥还有自己的plane mask (同cullAndDraw_masked), 所有视锥都剔掉了才停止往下走.
+// 结果out[v]和对视锥v单独调用cullAndDraw一样.
+constexpr size_t MAX_VIEWS = 32;
+
+void cullMultiView(const Node* n, const vector<Frustum>& views, vector<vector<const Node*>>& out,
+                   uint32_t viewMask, const uint32_t* planeMasks) {
+    uint32_t childMasks[MAX_VIEWS];
+    uint32_t childViews = 0;
+    for (uint32_t vm = viewMask; vm; vm &= vm - 1) {
+        int v = __builtin_ctz(vm);
+        // 多个视锥共享一个节点, lastRejectPlane缓存不了, 不用.
+        int reject = -1;
+        uint32_t m = planeMasks[v] ? cullPlanes(n->cachedWorldAABB_aggregate(), views[v], planeMasks[v], reject) : 0;
+        if (m == CULL_OUTSIDE) continue;
+        childViews |= 1u << v;
+        childMasks[v] = m;
+        bool visible = m ? cullPlanes(n->cachedWorldAABB(), views[v], m, reject) != CULL_OUTSIDE
+                         : !n->cachedWorldAABB().isEmpty();
+        if (visible) out[v].push_back(n);
+    }
+    if (!childViews) return;
+    for (auto* c : n->children) cullMultiView(c, views, out, childViews, childMasks);
+}
 
-/*===== Output =====
+void cullMultiView(const Node* root, const vector<Frustum>& views, vector<vector<const Node*>>& out) {
+    assert(views.size() <= MAX_VIEWS);
+    out.assign(views.size(), {});
+    if (!root || views.empty()) return;
+    uint32_t planeMasks[MAX_VIEWS];
+    std::fill(planeMasks, planeMasks + views.size(), CULL_ALL_PLANES);
+    uint32_t viewMask = views.size() == 32 ? UINT32_MAX : (1u << views.size()) - 1;
+    cullMultiView(root, views, out, viewMask, planeMasks);
+}
 
-[RUN  ] gfx_tree
-subtest1
-build tree.
-traverse tree.
-name=root, translation=(0, 0, 0)
-  name=1, translation=(1, 2, 3)
-    name=2, translation=(4, 5, 6)
-    name=3, translation=(7, 8, 9)
-    name=4, translation=(10, 11, 12)
+//=========================================================
+// LOD选择 (screen-space error)
+// 几何误差投影到屏幕上有多少像素: sse = geometricError * projScale / distance,
+//   projScale = 屏幕高度(像素) / (2 * tan(fovy / 2)), distance是相机到节点world AABB最近的点.
+// 选sse不超过threshold像素的最粗糙的一级, 远处的东西自动用低精度.
+// hysteresis: 物体在阈值附近的时候, 每帧来回切换会闪. 变精细马上切 (sse > threshold),
+// 变粗糙要等更粗的那一级的sse < threshold * (1 - hysteresis) 才切.
+// 在裁剪的同一次遍历里做, 不可见的节点不用算.
+struct LodParams {
+    vec3 eye;
+    float projScale;
+    float threshold = 1.0f;   // 像素
+    float hysteresis = 0.2f;  // 比例
+
+    static LodParams fromPerspective(const vec3& eye, float fovyRad, float screenHeight, float threshold = 1.0f) {
+        return {eye, screenHeight / (2.0f * tan(fovyRad / 2)), threshold};
+    }
+
+    float screenError(float geometricError, float distance) const {
+        // 相机在AABB里面, 用最精细的
+        if (distance <= 1e-6f) return std::numeric_limits<float>::infinity();
+        return geometricError * projScale / distance;
+    }
+};
+
+// 点到AABB最近的距离, 在里面是0.
+inline float distanceToAABB(const vec3& p, const AABB& b) {
+    vec3 q = {std::clamp(p.x, b.min.x, b.max.x), std::clamp(p.y, b.min.y, b.max.y), std::clamp(p.z, b.min.z, b.max.z)};
+    return distance(p, q);
+}
+
+// 从上一帧的级别出发, 往精细或者粗糙的方向走, 不从头找, 相机连续移动的时候一般一步就停.
+int selectLod(const LodComponent& lod, const LodParams& params, float dist) {
+    int n = int(lod.levels.size());
+    int cur = std::clamp(lod.current, 0, n - 1);
+    while (cur > 0 && params.screenError(lod.levels[cur].geometricError, dist) > params.threshold) {
+        cur--;
+    }
+    const float coarsen = params.threshold * (1.0f - params.hysteresis);
+    while (cur + 1 < n && params.screenError(lod.levels[cur + 1].geometricError, dist) < coarsen) {
+        cur++;
+    }
+    lod.current = cur;
+    return cur;
+}
+
+struct DrawItem {
+    const Node* node;
+    int lod;  // -1: 节点没有LOD组件
+};
+
+// 和cullAndDraw_masked一样做视锥裁剪 (plane mask继承), 可见的节点顺便选LOD.
+void cullAndSelectLod(const Node* n, const Frustum& fr, const LodParams& params, vector<DrawItem>& out,
+                      uint32_t mask = CULL_ALL_PLANES) {
+    if (!n) return;
+    uint32_t m = mask ? cullPlanes(n->cachedWorldAABB_aggregate(), fr, mask, n->lastRejectPlane) : 0;
+    if (m == CULL_OUTSIDE) return;
+    const AABB& self = n->cachedWorldAABB();
+    int selfReject = -1;
+    bool visible = m ? cullPlanes(self, fr, m, selfReject) != CULL_OUTSIDE : !self.isEmpty();
+    if (visible) {
+        int level = -1;
+        if (n->lod && !n->lod->levels.empty()) {
+            level = selectLod(*n->lod, params, distanceToAABB(params.eye, self));
+        }
+        out.push_back({n, level});
+    }
+    for (auto* c : n->children) cullAndSelectLod(c, fr, params, out, m);
+}
+
+//=========================================================
+// 并行遍历 / 更新
+/*
+follow-up 5里面的traverseParallel_thread是root的每个孩子开一个std::thread:
+    孩子多的时候线程太多, 孩子少的时候又并行不起来, 子树大小不均匀的时候负载也不均匀.
+改成work-stealing线程池上的fork-join:
+    1, 每个worker一个自己的deque, 自己从后面push/pop (LIFO, cache热), 空了就从别人的前面偷 (FIFO, 偷大任务).
+    2, 按子树大小切任务: subtreeCount <= cutoff 的子树直接在当前线程顺序跑, 大的子树每个孩子一个task.
+    3, 等待子任务的时候当前线程不闲着, 继续帮忙跑队列里的task (否则worker都在wait会死锁).
+    4, 结果确定性: 每个task只写自己子树里的节点, 聚合AABB和可见列表都在join之后按孩子顺序合并,
+       和顺序版本的结果完全一样, 不依赖调度顺序.
+这里每个deque用一个mutex保护, 真正的实现会用lock-free的Chase-Lev deque.
+*/
+
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(size_t cnt) {
+        for (size_t i = 0; i < cnt; ++i) {
+            queues.push_back(make_unique<Queue>());
+        }
+        for (size_t i = 0; i < cnt; ++i) {
+            workers.emplace_back([this, i] {
+                tlsPool = this;
+                tlsIndex = (int)i;
+                while (!stop) {
+                    if (runOne()) continue;
+                    // 没活干就睡, 有新task或者stop的时候唤醒
+                    unique_lock<mutex> lck(sleepMtx);
+                    cv.wait(lck, [&] { return stop || queued > 0; });
+                }
+            });
+        }
+    }
+
+    ~WorkStealingPool() {
+        {
+            lock_guard<mutex> lck(sleepMtx);
+            stop = true;
+        }
+        cv.notify_all();
+        for (auto& t : workers) {
+            if (t.joinable()) t.join();
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // worker线程放到自己的deque, 外部线程轮流放.
+    void submit(function<void()> task) {
+        size_t idx = (tlsPool == this) ? (size_t)tlsIndex : (nextQueue++ % queues.size());
+        {
+            lock_guard<mutex> lck(queues[idx]->mtx);
+            queues[idx]->tasks.push_back(move(task));
+        }
+        {
+            lock_guard<mutex> lck(sleepMtx);
+            queued++;
+        }
+        cv.notify_one();
+    }
+
+    // 先拿自己的, 再偷别人的. 跑了一个task返回true.
+    bool runOne() {
+        function<void()> task;
+        size_t n = queues.size();
+        size_t self = (tlsPool == this) ? (size_t)tlsIndex : 0;
+        for (size_t k = 0; k < n && !task; ++k) {
+            Queue& q = *queues[(self + k) % n];
+            lock_guard<mutex> lck(q.mtx);
+            if (q.tasks.empty()) continue;
+            if (k == 0 && tlsPool == this) {
+                task = move(q.tasks.back());  // 自己的, LIFO
+                q.tasks.pop_back();
+            } else {
+                task = move(q.tasks.front());  // 偷的, FIFO
+                q.tasks.pop_front();
+            }
+        }
+        if (!task) return false;
+        queued--;
+        task();
+        return true;
+    }
+
+private:
+    struct Queue {
+        mutex mtx;
+        deque<function<void()>> tasks;
+    };
+    vector<unique_ptr<Queue>> queues;
+    vector<thread> workers;
+
+    mutex sleepMtx;
+    condition_variable cv;
+    atomic<int> queued{0};
+    atomic<bool> stop{false};
+    atomic<size_t> nextQueue{0};
+
+    // 当前线程是哪个pool的第几个worker
+    inline static thread_local WorkStealingPool* tlsPool = nullptr;
+    inline static thread_local int tlsIndex = -1;
+};
+
+// fork-join: run()派发子任务, wait()等全部完成, 等的时候帮忙跑别的task.
+class TaskGroup {
+public:
+    explicit TaskGroup(WorkStealingPool& p) : pool(p) {}
+    ~TaskGroup() { wait(); }
+
+    void run(function<void()> f) {
+        pending++;
+        pool.submit([this, f = move(f)] {
+            f();
+            pending--;
+        });
+    }
+
+    void wait() {
+        while (pending > 0) {
+            if (!pool.runOne()) this_thread::yield();
+        }
+    }
+
+private:
+    WorkStealingPool& pool;
+    atomic<int> pending{0};
+};
+
+// 子树节点数不超过cutoff就不再切分, 顺序跑. task太小的话调度开销比干活还大.
+constexpr size_t PARALLEL_CUTOFF = 1024;
+
+// 和Node::updateWorld()一样, 大子树的孩子分给线程池.
+int updateWorld_parallel(Node* n, WorkStealingPool& pool, size_t cutoff = PARALLEL_CUTOFF, bool parentChanged = false) {
+    if (n->subtreeCount <= cutoff) {
+        return n->updateWorld(parentChanged);
+    }
+    bool changed = parentChanged || n->transformDirty;
+    if (!changed && !n->boundsDirty) {
+        return 0;
+    }
+
+    int cnt = n->updateSelfWorld(changed);
+    vector<int> childCnt(n->children.size(), 0);
+    {
+        TaskGroup tg(pool);
+        for (size_t i = 0; i < n->children.size(); ++i) {
+            Node* c = n->children[i];
+            tg.run([&, i, c] { childCnt[i] = updateWorld_parallel(c, pool, cutoff, changed); });
+        }
+        tg.wait();
+    }
+    for (int c : childCnt) cnt += c;
+    n->mergeChildrenBounds();
+    return cnt;
+}
+
+// 不用缓存的聚合AABB, 对应Node::worldAABB_aggregate().
+AABB worldAABB_aggregate_parallel(const Node* n, WorkStealingPool& pool, size_t cutoff = PARALLEL_CUTOFF) {
+    if (n->subtreeCount <= cutoff) {
+        return n->worldAABB_aggregate();
+    }
+    vector<AABB> childAgg(n->children.size(), AABB::empty());
+    {
+        TaskGroup tg(pool);
+        for (size_t i = 0; i < n->children.size(); ++i) {
+            const Node* c = n->children[i];
+            tg.run([&, i, c] { childAgg[i] = worldAABB_aggregate_parallel(c, pool, cutoff); });
+        }
+        tg.wait();
+    }
+    AABB agg = n->worldAABB();
+    for (auto& b : childAgg) agg = AABB::merge(agg, b);
+    return agg;
+}
+
+// 每个孩子写自己的列表, join之后按孩子顺序拼起来, 和顺序版本的顺序一样.
+void cullAndDraw_parallel(const Node* n, const Frustum& fr, vector<const Node*>& out, WorkStealingPool& pool,
+                          size_t cutoff = PARALLEL_CUTOFF) {
+    if (n->subtreeCount <= cutoff) {
+        cullAndDraw(n, fr, out);
+        return;
+    }
+    if (!aabbInsideFrustum(n->cachedWorldAABB_aggregate(), fr)) return;
+    if (aabbInsideFrustum(n->cachedWorldAABB(), fr)) {
+        out.push_back(n);
+    }
+    vector<vector<const Node*>> childOut(n->children.size());
+    {
+        TaskGroup tg(pool);
+        for (size_t i = 0; i < n->children.size(); ++i) {
+            const Node* c = n->children[i];
+            tg.run([&, i, c] { cullAndDraw_parallel(c, fr, childOut[i], pool, cutoff); });
+        }
+        tg.wait();
+    }
+    for (auto& v : childOut) out.insert(out.end(), v.begin(), v.end());
+}
+
+//=========================================================
+// 软件遮挡剔除 (CPU occlusion culling)
+// 视锥裁剪只去掉视锥外面的东西, 城市场景里视锥里面的楼大部分其实被前面的楼挡住了. 不用GPU的做法:
+// 1, 选一些大的物体当遮挡体 (occluder), 把它们的AABB光栅化到一个低分辨率的深度缓冲里, 一次8个像素 (AVX2).
+// 2, 建max-depth的mip金字塔 (Hi-Z), 每个texel存下一层2x2里面最远的深度.
+// 3, 测试的时候把AABB投影到屏幕上, 得到一个矩形和最近的深度. 找矩形只盖住2x2个texel的那层mip,
+//    取里面最远的深度, AABB最近的点都比它还远, 就是被挡住了.
+// 保守: 只会多留. 有角点在相机后面的AABB直接当可见, 这样的遮挡体直接不画.
+// 遮挡体按像素中心光栅化, 边上最多差一个像素, 和常见的实现一样.
+// 多线程: 按行分成条带, 每个条带一个task画所有三角形落在这几行的部分, 各写各的行, 不用锁.
+class OcclusionBuffer {
+public:
+    // 宽度补到8的倍数, 一行正好是整数个8像素
+    OcclusionBuffer(int w, int h) : width((w + 7) & ~7), height(h) {
+        int mw = width, mh = height;
+        while (true) {
+            mipW.push_back(mw);
+            mipH.push_back(mh);
+            mips.emplace_back(size_t(mw) * mh, 1.0f);
+            if (mw == 1 && mh == 1) break;
+            mw = (mw + 1) / 2;
+            mh = (mh + 1) / 2;
+        }
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    void setViewProj(const mat4& m) { vp = m; }
+
+    // depth[0]是最高分辨率的深度缓冲, 0最近, 1最远.
+    const vector<float>& depth() const { return mips[0]; }
+
+    // 清空, 光栅化所有遮挡体, 建Hi-Z. pool非空就按条带并行.
+    void render(const vector<AABB>& occluders, WorkStealingPool* pool = nullptr) {
+        fill(mips[0].begin(), mips[0].end(), 1.0f);
+        vector<Triangle> tris;
+        for (auto& b : occluders) setupTriangles(b, tris);
+
+        if (!pool) {
+            for (auto& t : tris) rasterize(t, 0, height);
+        } else {
+            TaskGroup tg(*pool);
+            for (int y0 = 0; y0 < height; y0 += BAND_ROWS) {
+                int y1 = std::min(y0 + BAND_ROWS, height);
+                tg.run([this, &tris, y0, y1] {
+                    for (auto& t : tris) rasterize(t, y0, y1);
+                });
+            }
+            tg.wait();
+        }
+        buildHiZ();
+    }
+
+    // AABB是不是可能可见, 要先render().
+    bool isVisible(const AABB& b) const {
+        if (b.isEmpty()) return false;
+        ScreenVert v[8];
+        if (!projectCorners(b, v)) return true;
+
+        float minX = v[0].x, maxX = v[0].x, minY = v[0].y, maxY = v[0].y, minZ = v[0].z;
+        for (int i = 1; i < 8; ++i) {
+            minX = std::min(minX, v[i].x);
+            maxX = std::max(maxX, v[i].x);
+            minY = std::min(minY, v[i].y);
+            maxY = std::max(maxY, v[i].y);
+            minZ = std::min(minZ, v[i].z);
+        }
+        // 在屏幕外面, 交给视锥裁剪
+        if (maxX < 0 || maxY < 0 || minX >= width || minY >= height) return true;
+
+        // 矩形盖住的像素, 包含
+        int x0 = std::max(0, int(floor(minX))), x1 = std::min(width - 1, int(floor(maxX)));
+        int y0 = std::max(0, int(floor(minY))), y1 = std::min(height - 1, int(floor(maxY)));
+        size_t level = 0;
+        while ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1) level++;
+
+        const vector<float>& mip = mips[level];
+        float maxDepth = 0;
+        for (int ty = y0 >> level; ty <= (y1 >> level); ++ty) {
+            for (int tx = x0 >> level; tx <= (x1 >> level); ++tx) {
+                maxDepth = std::max(maxDepth, mip[size_t(ty) * mipW[level] + tx]);
+            }
+        }
+        return minZ <= maxDepth + DEPTH_EPS;
+    }
+
+private:
+    static constexpr int BAND_ROWS = 16;
+    // 遮挡体自己的正面和它的AABB最近点深度一样, 插值的误差不能让它把自己挡掉.
+    static constexpr float DEPTH_EPS = 1e-5f;
+
+    struct ScreenVert {
+        float x, y, z;  // 像素坐标, 深度[0, 1]
+    };
+
+    // 屏幕空间的平面方程 f(x, y) = a * x + b * y + c, 3条边和深度.
+    struct Triangle {
+        float ea[3], eb[3], ec[3];
+        float za, zb, zc;
+        int x0, x1, y0, y1;  // 包围盒, 包含
+    };
+
+    // 角点i: bit0 x取max, bit1 y取max, bit2 z取max. 有角点在相机后面返回false.
+    bool projectCorners(const AABB& b, ScreenVert v[8]) const {
+        for (int i = 0; i < 8; ++i) {
+            vec3 p = {(i & 1) ? b.max.x : b.min.x, (i & 2) ? b.max.y : b.min.y, (i & 4) ? b.max.z : b.min.z};
+            float c[4];
+            transformClip(vp, p, c);
+            if (c[3] <= 1e-5f) return false;
+            float invW = 1.0f / c[3];
+            v[i] = {(c[0] * invW * 0.5f + 0.5f) * width, (c[1] * invW * 0.5f + 0.5f) * height,
+                    c[2] * invW * 0.5f + 0.5f};
+        }
+        return true;
+    }
+
+    // 6个面, 从外面看逆时针, 投影以后逆时针(面积 > 0)的是正面, 背面不用画.
+    void setupTriangles(const AABB& b, vector<Triangle>& tris) const {
+        static const int faces[6][4] = {{0, 4, 6, 2}, {1, 3, 7, 5}, {0, 1, 5, 4},
+                                        {2, 6, 7, 3}, {0, 2, 3, 1}, {4, 5, 7, 6}};
+        ScreenVert v[8];
+        if (b.isEmpty() || !projectCorners(b, v)) return;
+        for (auto& f : faces) {
+            addTriangle(v[f[0]], v[f[1]], v[f[2]], tris);
+            addTriangle(v[f[0]], v[f[2]], v[f[3]], tris);
+        }
+    }
+
+    void addTriangle(const ScreenVert& a, const ScreenVert& b, const ScreenVert& c, vector<Triangle>& tris) const {
+        float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+        if (!(area > 0)) return;
+
+        float minX = std::max(0.0f, std::min({a.x, b.x, c.x}));
+        float maxX = std::min(float(width - 1), std::max({a.x, b.x, c.x}));
+        float minY = std::max(0.0f, std::min({a.y, b.y, c.y}));
+        float maxY = std::min(float(height - 1), std::max({a.y, b.y, c.y}));
+        if (minX > maxX || minY > maxY) return;
+
+        Triangle t;
+        // 边 p->q: 在左边(里面)为正, f = (p.y - q.y) * x + (q.x - p.x) * y + (p.x * q.y - p.y * q.x)
+        const ScreenVert* vs[3] = {&a, &b, &c};
+        for (int i = 0; i < 3; ++i) {
+            const ScreenVert& p = *vs[(i + 1) % 3];
+            const ScreenVert& q = *vs[(i + 2) % 3];
+            t.ea[i] = p.y - q.y;
+            t.eb[i] = q.x - p.x;
+            t.ec[i] = p.x * q.y - p.y * q.x;
+        }
+        // 重心坐标: 顶点i的权重 = 对边的边函数 / area, 深度在屏幕空间是线性的
+        float inv = 1.0f / area;
+        t.za = (t.ea[0] * a.z + t.ea[1] * b.z + t.ea[2] * c.z) * inv;
+        t.zb = (t.eb[0] * a.z + t.eb[1] * b.z + t.eb[2] * c.z) * inv;
+        t.zc = (t.ec[0] * a.z + t.ec[1] * b.z + t.ec[2] * c.z) * inv;
+        t.x0 = int(minX);
+        t.x1 = int(maxX);
+        t.y0 = int(minY);
+        t.y1 = int(maxY);
+        tris.push_back(t);
+    }
+
+    // 只画[yBegin, yEnd)这几行. 深度取min.
+    void rasterize(const Triangle& t, int yBegin, int yEnd) {
+        int ys = std::max(t.y0, yBegin), ye = std::min(t.y1, yEnd - 1);
+        int xs = t.x0 & ~7;
+        float* buf = mips[0].data();
+        for (int y = ys; y <= ye; ++y) {
+            float py = y + 0.5f;
+            float r0 = t.eb[0] * py + t.ec[0];
+            float r1 = t.eb[1] * py + t.ec[1];
+            float r2 = t.eb[2] * py + t.ec[2];
+            float rz = t.zb * py + t.zc;
+            float* row = buf + size_t(y) * width;
+            int x = xs;
+#ifdef __AVX2__
+            const __m256 lane = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+            const __m256 zero = _mm256_setzero_ps();
+            for (; x <= t.x1; x += 8) {
+                __m256 px = _mm256_add_ps(_mm256_set1_ps(float(x)), lane);
+                __m256 e0 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.ea[0]), px), _mm256_set1_ps(r0));
+                __m256 e1 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.ea[1]), px), _mm256_set1_ps(r1));
+                __m256 e2 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.ea[2]), px), _mm256_set1_ps(r2));
+                __m256 inside = _mm256_and_ps(_mm256_cmp_ps(e0, zero, _CMP_GE_OQ),
+                                              _mm256_and_ps(_mm256_cmp_ps(e1, zero, _CMP_GE_OQ),
+                                                            _mm256_cmp_ps(e2, zero, _CMP_GE_OQ)));
+                if (_mm256_testz_ps(inside, inside)) continue;
+                __m256 z = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.za), px), _mm256_set1_ps(rz));
+                __m256 cur = _mm256_loadu_ps(row + x);
+                _mm256_storeu_ps(row + x, _mm256_blendv_ps(cur, _mm256_min_ps(cur, z), inside));
+            }
+#endif
+            // 标量版本, 和上面的运算顺序一样
+            for (; x <= t.x1; ++x) {
+                float px = float(x) + 0.5f;
+                if (t.ea[0] * px + r0 >= 0 && t.ea[1] * px + r1 >= 0 && t.ea[2] * px + r2 >= 0) {
+                    float z = t.za * px + rz;
+                    row[x] = std::min(row[x], z);
+                }
+            }
+        }
+    }
+
+    // 每层的texel是下一层2x2里面最远的, 奇数边长的时候最后一个texel只有1个或2个孩子.
+    void buildHiZ() {
+        for (size_t l = 1; l < mips.size(); ++l) {
+            const vector<float>& src = mips[l - 1];
+            int sw = mipW[l - 1], sh = mipH[l - 1];
+            for (int y = 0; y < mipH[l]; ++y) {
+                int sy0 = 2 * y, sy1 = std::min(2 * y + 1, sh - 1);
+                for (int x = 0; x < mipW[l]; ++x) {
+                    int sx0 = 2 * x, sx1 = std::min(2 * x + 1, sw - 1);
+                    float m = std::max(std::max(src[size_t(sy0) * sw + sx0], src[size_t(sy0) * sw + sx1]),
+                                       std::max(src[size_t(sy1) * sw + sx0], src[size_t(sy1) * sw + sx1]));
+                    mips[l][size_t(y) * mipW[l] + x] = m;
+                }
+            }
+        }
+    }
+
+    int width, height;
+    mat4 vp;
+    vector<vector<float>> mips;
+    vector<int> mipW, mipH;
+};
+
+// 视锥裁剪之后再做遮挡测试, 聚合AABB被挡住了整棵子树都不要.
+void cullAndDraw_occlusion(const Node* n, const Frustum& fr, const OcclusionBuffer& ob, vector<const Node*>& out) {
+    if (!n) return;
+    const AABB& agg = n->cachedWorldAABB_aggregate();
+    if (!aabbInsideFrustum(agg, fr) || !ob.isVisible(agg)) return;
+    const AABB& self = n->cachedWorldAABB();
+    if (aabbInsideFrustum(self, fr) && ob.isVisible(self)) {
+        out.push_back(n);
+    }
+    for (auto* c : n->children) cullAndDraw_occlusion(c, fr, ob, out);
+}
+
+//=========================================================
+// 子树流式加载 (streaming)
+// GIS的例子 World -> Country -> State -> City -> Street -> POI, 不可能全部常驻内存.
+// 每个可以流式加载的子树平时只是一个占位节点 (placeholder), 只知道子树的包围盒 (从文件头读, 很便宜).
+// 每帧update():
+//   1, 把后台加载好的子树挂到占位节点下面. 只在主线程改场景, 后台线程只读文件建一棵独立的子树.
+//   2, 相机到包围盒的距离 < loadRadius就要加载. 还按速度预测prefetchSeconds以后相机在哪,
+//      预测的位置在范围内也提前加载, 走到跟前的时候已经在内存里了.
+//      近的先发, 同时在加载的不超过maxInFlight个.
+//   3, 内存预算: 常驻的加上正在加载的不能超过budgetBytes, 不够就按LRU卸载这一帧没用到的子树,
+//      卸载不出来就这一帧先不加载.
+// 挂上去/卸下来都会打dirty, update()之后在root上call updateWorld().
+// 文件格式就是上面的SceneFile, 子树的root在原点, 挂上去以后相对于占位节点.
+
+// 后台线程跑: 读一个场景文件建成Node子树, 失败返回nullptr.
+Node* loadSubtreeFromFile(const string& path) {
+    MappedScene ms;
+    if (!ms.open(path) || ms.size() == 0) return nullptr;
+    vector<Node*> nodes(ms.size());
+    vector<vec3> worldT(ms.size());
+    for (uint32_t i = 0; i < ms.size(); ++i) {
+        const SceneFileNode& fn = ms.node(i);
+        vec3 t = ms.localTranslation(i);
+        nodes[i] = new Node(string(ms.name(i)), t);
+        worldT[i] = (i == 0) ? t : worldT[fn.parent] + t;
+        // 文件里存的是world AABB, 换回local
+        AABB self = ms.worldAABB_self(i);
+        if (!self.isEmpty()) nodes[i]->setLocalAABB(self.translated(-worldT[i]));
+        if (i > 0) nodes[fn.parent]->addChild(nodes[i]);
+    }
+    return nodes[0];
+}
+
+class StreamingManager {
+public:
+    struct Config {
+        float loadRadius = 100;
+        float prefetchSeconds = 2;
+        size_t budgetBytes = 64 << 20;
+        int maxInFlight = 4;
+    };
+
+    StreamingManager(WorkStealingPool& p, const Config& c) : pool(p), cfg(c) {}
+    StreamingManager(const StreamingManager&) = delete;
+    StreamingManager& operator=(const StreamingManager&) = delete;
+
+    // 后台的加载任务引用着this, 要等它们结束. 加载好了还没挂上去的子树没人要了, 删掉.
+    ~StreamingManager() {
+        waitLoads();
+        for (auto& c : completed) delete c.second;
+    }
+
+    // placeholder要已经在场景里. 文件打不开返回false.
+    bool addPlaceholder(Node* placeholder, const string& path) {
+        MappedScene ms;
+        if (!ms.open(path) || ms.size() == 0) return false;
+        // 估计常驻以后占多少内存
+        size_t bytes = ms.size() * sizeof(Node);
+        for (uint32_t i = 0; i < ms.size(); ++i) bytes += ms.name(i).size();
+        entries.push_back({placeholder, path, ms.worldAABB_aggregate(0), bytes});
+        return true;
+    }
+
+    void update(const vec3& eye, const vec3& velocity) {
+        frame++;
+        integrateCompleted();
+
+        const vec3 predicted = eye + velocity * cfg.prefetchSeconds;
+        vector<pair<float, size_t>> toLoad;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            Entry& e = entries[i];
+            AABB box = e.localBounds.translated(e.placeholder->cachedWorldTranslation());
+            float d = std::min(distanceToAABB(eye, box), distanceToAABB(predicted, box));
+            if (d >= cfg.loadRadius) continue;
+            e.lastUsed = frame;
+            if (e.state == State::Unloaded) toLoad.push_back({d, i});
+        }
+        sort(toLoad.begin(), toLoad.end());
+        for (auto& [d, i] : toLoad) {
+            if (inFlight >= cfg.maxInFlight || !makeRoom(entries[i].bytes)) break;
+            issueLoad(i);
+        }
+    }
+
+    // 等所有的加载完成并且挂上去. 测试用, 真实的引擎每帧update()就行.
+    void waitIdle() {
+        waitLoads();
+        integrateCompleted();
+    }
+
+    bool isResident(const Node* placeholder) const {
+        for (auto& e : entries) {
+            if (e.placeholder == placeholder) return e.state == State::Resident;
+        }
+        return false;
+    }
+    size_t usedBytes() const { return used; }
+    size_t evictions() const { return evictCnt; }
+
+private:
+    enum class State { Unloaded, Loading, Resident };
+
+    struct Entry {
+        Node* placeholder;
+        string path;
+        AABB localBounds;
+        size_t bytes;
+        State state = State::Unloaded;
+        uint64_t lastUsed = 0;
+        Node* subtree = nullptr;
+    };
+
+    void issueLoad(size_t i) {
+        Entry& e = entries[i];
+        e.state = State::Loading;
+        used += e.bytes;  // 先占上预算
+        inFlight++;
+        pool.submit([this, i, path = e.path] {
+            Node* n = loadSubtreeFromFile(path);
+            {
+                lock_guard<mutex> lck(completedMtx);
+                completed.push_back({i, n});
+            }
+            inFlight--;
+        });
+    }
+
+    void integrateCompleted() {
+        vector<pair<size_t, Node*>> done;
+        {
+            lock_guard<mutex> lck(completedMtx);
+            done.swap(completed);
+        }
+        for (auto& [i, n] : done) {
+            Entry& e = entries[i];
+            if (!n) {
+                e.state = State::Unloaded;
+                used -= e.bytes;
+                continue;
+            }
+            e.placeholder->addChild(n);
+            e.subtree = n;
+            e.state = State::Resident;
+        }
+    }
+
+    // 按LRU卸载这一帧没用到的子树, 直到放得下bytes.
+    bool makeRoom(size_t bytes) {
+        while (used + bytes > cfg.budgetBytes) {
+            Entry* victim = nullptr;
+            for (auto& e : entries) {
+                if (e.state == State::Resident && e.lastUsed < frame && (!victim || e.lastUsed < victim->lastUsed)) {
+                    victim = &e;
+                }
+            }
+            if (!victim) return false;
+            victim->placeholder->removeChild(victim->subtree);
+            delete victim->subtree;
+            victim->subtree = nullptr;
+            victim->state = State::Unloaded;
+            used -= victim->bytes;
+            evictCnt++;
+        }
+        return true;
+    }
+
+    void waitLoads() {
+        while (inFlight > 0) {
+            if (!pool.runOne()) this_thread::yield();
+        }
+    }
+
+    WorkStealingPool& pool;
+    Config cfg;
+    vector<Entry> entries;
+    uint64_t frame = 0;
+    size_t used = 0;
+    size_t evictCnt = 0;
+    atomic<int> inFlight{0};
+    mutex completedMtx;
+    vector<pair<size_t, Node*>> completed;
+};
+
+// 测试用的随机树: 第i个节点的父节点从前i个里面随机选.
+Node* buildRandomTree(size_t n) {
+    auto rnd = [](float lo, float hi) { return lo + (hi - lo) * rand() / RAND_MAX; };
+    vector<Node*> nodes;
+    nodes.reserve(n);
+    nodes.push_back(new Node("root", {0, 0, 0}));
+    for (size_t i = 1; i < n; ++i) {
+        auto node = new Node(to_string(i), {rnd(-10, 10), rnd(-10, 10), rnd(-10, 10)});
+        node->setLocalAABB(AABB::fromCenterExtent({0, 0, 0}, {rnd(0, 1), rnd(0, 1), rnd(0, 1)}));
+        nodes[rand() % i]->addChild(node);
+        nodes.push_back(node);
+    }
+    return nodes[0];
+}
+
+//=========================================================
+// 压力测试的场景生成 + benchmark
+// subtest1/2手写的20个节点太小, 测不出任何东西. 这里生成4种形状的场景, 10^3到10^7个节点:
+//   Random      第i个节点的父节点从前i个里面随机选, 深度大概O(log n)
+//   Balanced    4叉完全树
+//   DeepChain   一条链, 深度 = n, 专门测递归会不会爆栈
+//   WideFanout  所有节点都是root的孩子, 测一个节点特别多孩子的情况
+// 先生成SceneSpec (父节点下标 + 变换 + AABB), 再分别建成Node树和SceneStorage, 两种布局可以对比.
+// 计时会让下面的Output每次都不一样, 默认只跑很小的场景检查正确性, 要跑benchmark把RUN_SCENE_BENCH改成1.
+#define RUN_SCENE_BENCH 0
+
+enum class SceneShape { Random, Balanced, DeepChain, WideFanout };
+
+const char* shapeName(SceneShape shape) {
+    switch (shape) {
+        case SceneShape::Random: return "random";
+        case SceneShape::Balanced: return "balanced";
+        case SceneShape::DeepChain: return "deep-chain";
+        case SceneShape::WideFanout: return "wide-fanout";
+    }
+    return "?";
+}
+
+struct SceneSpec {
+    vector<uint32_t> parent;  // parent[i] < i, root是UINT32_MAX
+    vector<vec3> localT;
+    vector<AABB> localAABB;
+
+    size_t size() const { return parent.size(); }
+
+    size_t maxDepth() const {
+        vector<uint32_t> depth(size(), 1);
+        size_t res = size() ? 1 : 0;
+        for (size_t i = 1; i < size(); ++i) {
+            depth[i] = depth[parent[i]] + 1;
+            res = std::max(res, size_t(depth[i]));
+        }
+        return res;
+    }
+};
+
+SceneSpec generateSceneSpec(SceneShape shape, size_t n, uint32_t seed) {
+    mt19937 rng(seed);
+    uniform_real_distribution<float> pos(-10, 10), ext(0, 1);
+    SceneSpec spec;
+    spec.parent.resize(n);
+    spec.localT.resize(n);
+    spec.localAABB.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t p = UINT32_MAX;
+        if (i > 0) {
+            switch (shape) {
+                case SceneShape::Random: p = uint32_t(rng() % i); break;
+                case SceneShape::Balanced: p = uint32_t((i - 1) / 4); break;
+                case SceneShape::DeepChain: p = uint32_t(i - 1); break;
+                case SceneShape::WideFanout: p = 0; break;
+            }
+        }
+        spec.parent[i] = p;
+        spec.localT[i] = (i == 0) ? vec3(0, 0, 0) : vec3(pos(rng), pos(rng), pos(rng));
+        // 链上的偏移太大的话world坐标会飘得很远, 改小一点
+        if (shape == SceneShape::DeepChain) spec.localT[i] *= 0.01f;
+        spec.localAABB[i] = (i == 0) ? AABB::empty() : AABB::fromCenterExtent({0, 0, 0}, {ext(rng), ext(rng), ext(rng)});
+    }
+    return spec;
+}
+
+// 从后往前挂: 挂孩子i的时候它的子树已经完整了, 父节点还没挂到树上,
+// addChild往上累加subtreeCount只走一步, 整个是O(n). 最后把每个节点的孩子倒回原来的顺序.
+Node* buildNodeTree(const SceneSpec& spec) {
+    vector<Node*> nodes(spec.size());
+    for (size_t i = 0; i < spec.size(); ++i) {
+        nodes[i] = new Node(to_string(i), spec.localT[i]);
+        nodes[i]->localAABB = spec.localAABB[i];
+    }
+    for (size_t i = spec.size(); i-- > 1;) nodes[spec.parent[i]]->addChild(nodes[i]);
+    for (auto* node : nodes) reverse(node->children.begin(), node->children.end());
+    return nodes.empty() ? nullptr : nodes[0];
+}
+
+SceneStorage buildSceneStorage(const SceneSpec& spec) {
+    SceneStorage s;
+    for (size_t i = 0; i < spec.size(); ++i) {
+        SceneHandle h = s.create(to_string(i), spec.localT[i], i ? SceneHandle{spec.parent[i]} : SceneHandle{});
+        s.setLocalAABB(h, spec.localAABB[i]);
+    }
+    s.sortHierarchy();
+    return s;
+}
+
+template <class F>
+double secondsOf(F&& f) {
+    auto t0 = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+}
+
+// Node的updateWorld/worldAABB_aggregate/cullAndDraw都是递归的, 太深的树跳过.
+constexpr size_t MAX_RECURSION_DEPTH = 10000;
+
+struct SceneBenchResult {
+    size_t visibleNode = 0, visibleStorage = 0;
+    AABB nodeAggregate = AABB::empty();
+    bool recursiveSkipped = false;
+};
+
+// 每一项打印 nodes/s. printTimes = false 只跑不打时间.
+SceneBenchResult benchScene(SceneShape shape, size_t n, bool printTimes) {
+    SceneBenchResult res;
+    SceneSpec spec = generateSceneSpec(shape, n, 1234);
+    Frustum fr = Frustum::fromBox(AABB::fromMinMax({-15, -15, -15}, {15, 15, 15}));
+    res.recursiveSkipped = spec.maxDepth() > MAX_RECURSION_DEPTH;
+
+    vector<pair<string, double>> t;
+    Node* root = nullptr;
+    t.push_back({"node build", secondsOf([&] { root = buildNodeTree(spec); })});
+    if (!res.recursiveSkipped) {
+        t.push_back({"node update", secondsOf([&] { root->updateWorld(); })});
+        // 不用缓存, 每个节点都走到root, 和缓存的结果只差加法顺序带来的舍入
+        t.push_back({"node aggregate", secondsOf([&] { res.nodeAggregate = root->worldAABB_aggregate(); })});
+        vector<const Node*> out;
+        t.push_back({"node cull", secondsOf([&] { cullAndDraw_masked(root, fr, out); })});
+        res.visibleNode = out.size();
+    }
+    assert(root->subtreeCount == n);
+    t.push_back({"node teardown", secondsOf([&] { delete root; })});
+
+    {
+        unique_ptr<SceneStorage> s;
+        t.push_back({"soa build", secondsOf([&] { s = make_unique<SceneStorage>(buildSceneStorage(spec)); })});
+        t.push_back({"soa update+aggregate", secondsOf([&] { s->updateWorld(); })});
+        vector<SceneHandle> out;
+        t.push_back({"soa cull", secondsOf([&] {
+                         s->traverse([&](SceneHandle h) {
+                             if (!aabbInsideFrustum(s->worldAABB_aggregate(h), fr)) return false;
+                             if (aabbInsideFrustum(s->worldAABB_self(h), fr)) out.push_back(h);
+                             return true;
+                         });
+                     })});
+        res.visibleStorage = out.size();
+        t.push_back({"soa teardown", secondsOf([&] { s.reset(); })});
+    }
+
+    if (printTimes) {
+        cout << shapeName(shape) << " n=" << n << (res.recursiveSkipped ? " (node recursion skipped)" : "") << endl;
+        for (auto& [name, sec] : t) {
+            printf("    %-22s %10.3f ms %12.0f nodes/s\n", name.c_str(), sec * 1e3, n / std::max(sec, 1e-9));
+        }
+    }
+    return res;
+}
+
+void subtest1() {
+    cout << __FUNCTION__ << endl;
+
+    cout << "build tree." << endl;
+    auto root =
+        // l0
+        createNode("root", vec3(0, 0, 0), {
+                                              // l1
+                                              createNode("1", vec3(1, 2, 3), {
+                                                                                 // l2
+                                                                                 createNode("2", vec3(4, 5, 6), {}),
+                                                                                 createNode("3", vec3(7, 8, 9), {}),
+                                                                                 createNode("4", vec3(10, 11, 12), {}),
+                                                                             }),
+                                              createNode("5", vec3(4, 5, 6), {
+                                                                                 createNode("6", vec3(4, 5, 6), {}),
+                                                                                 createNode("7", vec3(7, 8, 9), {}),
+                                                                                 createNode("8", vec3(10, 11, 12), {}),
+                                                                             }),
+                                              createNode("9", vec3(7, 8, 9), {
+                                                                                 createNode("10", vec3(4, 5, 6), {}),
+                                                                                 createNode("11", vec3(7, 8, 9), {}),
+                                                                                 createNode("12", vec3(10, 11, 12), {}),
+                                                                             }),
+                                              createNode("13", vec3(10, 11, 12), {
+                                                                                     createNode("14", vec3(4, 5, 6), {}),
+                                                                                     createNode("15", vec3(7, 8, 9), {}),
+                                                                                     createNode("16", vec3(10, 11, 12), {}),
+                                                                                 }),
+                                          });
+
+    // root->print();
+
+    cout << "traverse tree." << endl;
+    traverse(root);
+
+    delete root;
+}
+
+void subtest2() {
+    cout << __FUNCTION__ << endl;
+
+    // 假设场景是world里面有一个code car, 只有一个node wheel (单轮车), car和wheel的AABB有overlap, 但是不是包围关系.
+    // World (root)
+    //   └─ Car (Node)
+    //     └─ Wheel (Node)
+
+    auto root = new Node("root", {0, 0, 0});
+
+    auto car = new Node("car", {5, 0, 0});                       // 位置（相对 World）：(5, 0, 0)
+    car->localAABB = AABB::fromMinMax({-1, -1, -2}, {1, 1, 2});  // 假设车的模型长 2m、宽 2m、高 4m
+
+    auto wheel = new Node("wheel", {1, -1, 0});                                      // 位置（相对 Car）：(1, -1, 0)
+    wheel->localAABB = AABB::fromMinMax({-0.5f, -0.5f, -0.5f}, {0.5f, 0.5f, 0.5f});  // 轮子直径 1m、宽 1m、厚 1m
+
+    root->addChild(car);
+    car->addChild(wheel);
+
+    AABB sceneBox = root->worldAABB_aggregate();  // 面试展示：聚合包围盒
+    assert(sceneBox.min == vec3(4, -1.5, -2) && sceneBox.max == vec3(6.5, 1, 2));
+
+    delete root;
+}
+
+// 逐位比较. vec3的==带epsilon, 测不出bit-exact.
+bool sameBits(const AABB& a, const AABB& b) {
+    return memcmp(&a, &b, sizeof(AABB)) == 0;
+}
+
+// 批量变换AABB, 见aabb.h里面的transformAABBs, 每个dynamic node每帧都要重算world bounds.
+// SoA存, AVX2一次8个box, 和单个的AABB::transformed结果要逐位一致.
+void subtest3() {
+    cout << __FUNCTION__ << endl;
+
+    // 单个box: 绕z转90度再平移, x/y的extent互换.
+    {
+        AABB box = AABB::fromMinMax({-1, -2, -3}, {1, 2, 3});
+        mat4 M = translate({10, 0, 0}) * rotateZ(3.14159265f / 2);
+        AABB res = box.transformed(M);
+        assert(res.min == vec3(8, -1, -3) && res.max == vec3(12, 1, 3));
+        assert(AABB::empty().transformed(M).isEmpty());
+    }
+
+    srand(41);
+    auto rnd = [](float lo, float hi) { return lo + (hi - lo) * rand() / RAND_MAX; };
+
+    // 故意不是8的倍数, 测尾巴. 中间放几个empty的box (没有几何的node).
+    const size_t n = 37;
+    AABBSoA boxes;
+    vector<mat4> mats(n);
+    for (size_t i = 0; i < n; ++i) {
+        if (i % 10 == 3) {
+            boxes.push_back(AABB::empty());
+        } else {
+            vec3 c(rnd(-50, 50), rnd(-50, 50), rnd(-50, 50));
+            vec3 e(rnd(0, 5), rnd(0, 5), rnd(0, 5));
+            boxes.push_back(AABB::fromCenterExtent(c, e));
+        }
+        mats[i] = translate({rnd(-10, 10), rnd(-10, 10), rnd(-10, 10)}) * rotateZ(rnd(0, 6.28f)) * scale({rnd(0.5f, 2), 1, rnd(0.5f, 2)});
+    }
+
+    // 一个矩阵
+    AABBSoA out;
+    transformAABBs(boxes, mats[0], out);
+    assert(out.size() == n);
+    for (size_t i = 0; i < n; ++i) {
+        AABB ref = boxes.get(i).transformed(mats[0]);
+        AABB res = out.get(i);
+        if (ref.isEmpty()) {
+            assert(res.isEmpty());
+        } else {
+            assert(sameBits(res, ref));
+        }
+    }
+
+    // 每个box一个矩阵
+    transformAABBs(boxes, mats.data(), out);
+    for (size_t i = 0; i < n; ++i) {
+        AABB ref = boxes.get(i).transformed(mats[i]);
+        AABB res = out.get(i);
+        if (ref.isEmpty()) {
+            assert(res.isEmpty());
+        } else {
+            assert(sameBits(res, ref));
+        }
+    }
+    cout << "transformed " << n << " boxes." << endl;
+}
+
+// SceneStorage, 和指针版本的Node结果要一致.
+void subtest4() {
+    cout << __FUNCTION__ << endl;
+
+    // 和subtest2一样的场景, 从Node树转过来.
+    {
+        auto root = new Node("root", {0, 0, 0});
+        auto car = new Node("car", {5, 0, 0});
+        car->localAABB = AABB::fromMinMax({-1, -1, -2}, {1, 1, 2});
+        auto wheel = new Node("wheel", {1, -1, 0});
+        wheel->localAABB = AABB::fromMinMax({-0.5f, -0.5f, -0.5f}, {0.5f, 0.5f, 0.5f});
+        root->addChild(car);
+        car->addChild(wheel);
+
+        SceneStorage scene = SceneStorage::fromTree(root);
+        scene.updateWorld();
+        assert(scene.size() == 3);
+
+        SceneHandle hRoot{0};
+        AABB sceneBox = scene.worldAABB_aggregate(hRoot);
+        AABB ref = root->worldAABB_aggregate();
+        assert(sceneBox.min == ref.min && sceneBox.max == ref.max);
+
+        delete root;
+    }
+
+    // 直接用handle建, 孩子的顺序故意打乱, 再换父节点.
+    //   root
+    //   ├─ a (1,0,0)
+    //   │   └─ c (0,1,0)
+    //   └─ b (0,0,1)
+    //       └─ d (0,0,1)
+    {
+        SceneStorage scene;
+        SceneHandle root = scene.create("root", {0, 0, 0});
+        SceneHandle a = scene.create("a", {1, 0, 0}, root);
+        SceneHandle b = scene.create("b", {0, 0, 1}, root);
+        SceneHandle c = scene.create("c", {0, 1, 0}, a);
+        SceneHandle d = scene.create("d", {0, 0, 1}, b);
+        scene.setLocalAABB(d, AABB::fromMinMax({-1, -1, -1}, {1, 1, 1}));
+        scene.updateWorld();
+
+        assert(scene.worldTranslation(c) == vec3(1, 1, 0));
+        assert(scene.worldTranslation(d) == vec3(0, 0, 2));
+        assert(scene.name(scene.parentOf(d)) == "b");
+
+        // pre-order
+        string order;
+        scene.traverse([&](SceneHandle h) { order += scene.name(h) + " "; return true; });
+        cout << "pre-order: " << order << endl;
+        assert(order == "root a c b d ");
+
+        // 跳过子树a
+        order.clear();
+        scene.traverse([&](SceneHandle h) { order += scene.name(h) + " "; return h.id != a.id; });
+        assert(order == "root a b d ");
+
+        // d挪到c下面, handle依然有效
+        scene.setParent(d, c);
+        scene.setLocalTranslation(d, {0, 0, 5});
+        scene.updateWorld();
+        assert(scene.worldTranslation(d) == vec3(1, 1, 5));
+        AABB agg = scene.worldAABB_aggregate(a);
+        assert(agg.min == vec3(0, 0, 4) && agg.max == vec3(2, 2, 6));
+        assert(scene.worldAABB_aggregate(b).isEmpty());
+
+        order.clear();
+        scene.traverse([&](SceneHandle h) { order += scene.name(h) + " "; return true; });
+        cout << "pre-order after reparent: " << order << endl;
+        assert(order == "root a c d b ");
+    }
+}
+
+// dirty flag: 只重算改动过的子树, 结果和每次都走到root的版本一致.
+void subtest5() {
+    cout << __FUNCTION__ << endl;
+
+    // World
+    //   ├─ Car
+    //   │    ├─ Wheel_L
+    //   │    └─ Wheel_R
+    //   └─ Building
+    auto root = createNode("root", {0, 0, 0}, {
+                                                  createNode("car", {5, 0, 0}, {
+                                                                                   createNode("wheel_L", {-1, -1, 0}),
+                                                                                   createNode("wheel_R", {1, -1, 0}),
+                                                                               }),
+                                                  createNode("building", {-20, 0, 0}),
+                                              });
+    Node* car = root->children[0];
+    Node* wheelL = car->children[0];
+    Node* wheelR = car->children[1];
+    Node* building = root->children[1];
+    car->setLocalAABB(AABB::fromMinMax({-1, -1, -2}, {1, 1, 2}));
+    wheelL->setLocalAABB(AABB::fromMinMax({-0.5f, -0.5f, -0.5f}, {0.5f, 0.5f, 0.5f}));
+    wheelR->setLocalAABB(AABB::fromMinMax({-0.5f, -0.5f, -0.5f}, {0.5f, 0.5f, 0.5f}));
+    building->setLocalAABB(AABB::fromMinMax({-5, 0, -5}, {5, 30, 5}));
+
+    auto check = [&](Node* n) {
+        assert(n->cachedWorldTranslation() == n->worldTranslation());
+        AABB ref = n->worldAABB_aggregate();
+        assert(n->cachedWorldAABB_aggregate().min == ref.min && n->cachedWorldAABB_aggregate().max == ref.max);
+    };
+
+    // 第一帧全部都要算
+    int cnt = root->updateWorld();
+    cout << "frame 1 updated: " << cnt << endl;
+    assert(cnt == 5);
+    for (auto* n : {root, car, wheelL, wheelR, building}) check(n);
+
+    // 什么都没变
+    cnt = root->updateWorld();
+    assert(cnt == 0);
+
+    // 车动了, 车和两个轮子要重算, building不用
+    car->setPosition({6, 0, 0});
+    cnt = root->updateWorld();
+    cout << "frame 3 updated: " << cnt << endl;
+    assert(cnt == 3);
+    for (auto* n : {root, car, wheelL, wheelR, building}) check(n);
+    assert(wheelR->cachedWorldTranslation() == vec3(7, -1, 0));
+
+    // 只改轮子的AABB, transform不用重算, 但是聚合AABB要更新
+    wheelR->setLocalAABB(AABB::fromMinMax({-2, -2, -2}, {2, 2, 2}));
+    cnt = root->updateWorld();
+    assert(cnt == 0);
+    for (auto* n : {root, car, wheelL, wheelR, building}) check(n);
+
+    // 加一个新节点
+    auto driver = new Node("driver", {0, 1, 0});
+    driver->setLocalAABB(AABB::fromMinMax({0, 0, 0}, {0, 100, 0}));
+    car->addChild(driver);
+    cnt = root->updateWorld();
+    assert(cnt == 1);
+    check(root);
+    assert(root->cachedWorldAABB_aggregate().max.y == 101);
+
+    delete root;
+}
+
+// 并行版本和顺序版本结果一致.
+void subtest6() {
+    cout << __FUNCTION__ << endl;
+
+    Node::verboseDelete = false;
+    srand(41);
+    const size_t n = 20000;
+    Node* root = buildRandomTree(n);
+    assert(root->subtreeCount == n);
+
+    WorkStealingPool pool(4);
+    // cutoff设小一点, 让任务切得多一些
+    const size_t cutoff = 64;
+
+    int cnt = updateWorld_parallel(root, pool, cutoff);
+    cout << "parallel updated: " << cnt << endl;
+    assert(cnt == (int)n);
+
+    // 顺序版本做参考
+    AABB ref = root->worldAABB_aggregate();
+    AABB agg = worldAABB_aggregate_parallel(root, pool, cutoff);
+    assert(agg.min == ref.min && agg.max == ref.max);
+    assert(root->cachedWorldAABB_aggregate().min == ref.min && root->cachedWorldAABB_aggregate().max == ref.max);
+
+    Frustum fr = Frustum::fromBox(AABB::fromMinMax({-20, -20, -20}, {20, 20, 20}));
+    vector<const Node*> visible, visibleRef;
+    cullAndDraw(root, fr, visibleRef);
+    for (int k = 0; k < 3; ++k) {
+        visible.clear();
+        cullAndDraw_parallel(root, fr, visible, pool, cutoff);
+        assert(visible == visibleRef);
+    }
+    cout << "visible: " << visible.size() << " / " << n << endl;
+
+    // 动一个子树, 只重算它
+    Node* moved = root->children[0];
+    moved->setPosition(moved->transform.translation + vec3(1, 0, 0));
+    cnt = updateWorld_parallel(root, pool, cutoff);
+    assert(cnt == (int)moved->subtreeCount);
+    ref = root->worldAABB_aggregate();
+    assert(root->cachedWorldAABB_aggregate().min == ref.min && root->cachedWorldAABB_aggregate().max == ref.max);
+
+    delete root;
+    Node::verboseDelete = true;
+}
+
+// plane mask继承 + coherency, 结果不变, 平面测试变少.
+void subtest7() {
+    cout << __FUNCTION__ << endl;
+
+    Node::verboseDelete = false;
+    srand(42);
+    const size_t n = 20000;
+    Node* root = buildRandomTree(n);
+    root->updateWorld();
+
+    // 相机慢慢往+x移动, 连续3帧
+    for (int frame = 0; frame < 3; ++frame) {
+        float x = frame * 2.0f;
+        Frustum fr = Frustum::fromBox(AABB::fromMinMax({-15 + x, -15, -15}, {15 + x, 15, 15}));
+
+        vector<const Node*> ref, visible;
+        size_t naiveTests = 0, maskedTests = 0;
+        cullAndDraw(root, fr, ref, &naiveTests);
+        cullAndDraw_masked(root, fr, visible, CULL_ALL_PLANES, &maskedTests);
+        assert(visible == ref);
+        cout << "frame " << frame << ": visible " << visible.size() << ", plane tests naive " << naiveTests
+             << ", masked " << maskedTests << endl;
+        assert(maskedTests < naiveTests);
+    }
+
+    delete root;
+    Node::verboseDelete = true;
+}
+
+// 一次遍历裁剪多个视锥, 每个视锥的结果和单独cullAndDraw一样.
+void subtest8() {
+    cout << __FUNCTION__ << endl;
+
+    Node::verboseDelete = false;
+    srand(43);
+    Node* root = buildRandomTree(20000);
+    root->updateWorld();
+
+    // 主相机 + 4个cascade (从近到远越来越大) + 1个probe
+    vector<Frustum> views;
+    views.push_back(Frustum::fromBox(AABB::fromMinMax({-15, -15, -15}, {15, 15, 15})));
+    for (int i = 0; i < 4; ++i) {
+        float r = 5.0f * (1 << i);
+        views.push_back(Frustum::fromBox(AABB::fromMinMax({-r, -r, -50}, {r, r, 50})));
+    }
+    views.push_back(Frustum::fromBox(AABB::fromMinMax({20, 20, -5}, {40, 40, 5})));
+
+    vector<vector<const Node*>> out;
+    cullMultiView(root, views, out);
+    assert(out.size() == views.size());
+    for (size_t v = 0; v < views.size(); ++v) {
+        vector<const Node*> ref;
+        cullAndDraw(root, views[v], ref);
+        assert(out[v] == ref);
+        cout << "view " << v << ": visible " << out[v].size() << endl;
+    }
+
+    delete root;
+    Node::verboseDelete = true;
+}
+
+// 城市场景: 一堵墙挡住后面大部分的楼, 遮挡剔除以后画的东西少很多.
+void subtest9() {
+    cout << __FUNCTION__ << endl;
+
+    Node::verboseDelete = false;
+    srand(44);
+    auto rnd = [](float lo, float hi) { return lo + (hi - lo) * rand() / RAND_MAX; };
+    const int W = 256, H = 128;
+    mat4 vp = perspective(60.0f * 3.14159265f / 180.0f, float(W) / H, 0.1f, 500.0f) *
+              lookAt({0, 1.7f, 10}, {0, 1.7f, -100}, {0, 1, 0});
+    Frustum fr = Frustum::fromMatrix(vp);
+
+    auto box = [](const string& name, const vec3& pos, const AABB& local) {
+        Node* n = new Node(name, pos);
+        n->setLocalAABB(local);
+        return n;
+    };
+    Node* root = new Node("city", {0, 0, 0});
+    // 墙往地下多埋一截: 地面没有当遮挡体, 墙底边附近的texel是空的, Hi-Z取2x2 texel的时候会把它们算进去
+    root->addChild(box("wall", {0, 0, -20}, AABB::fromMinMax({-30, -10, -0.5f}, {30, 20, 0.5f})));
+    root->addChild(box("kiosk", {0, 0, -7}, AABB::fromMinMax({-2, 0, -2}, {2, 5, 2})));     // 墙前面
+    root->addChild(box("hidden", {0, 0, -40}, AABB::fromMinMax({-2, 0, -2}, {2, 10, 2})));  // 墙后面, 比墙矮
+    root->addChild(box("tower", {0, 0, -60}, AABB::fromMinMax({-2, 0, -2}, {2, 100, 2})));  // 墙后面, 高出墙
+    Node* blocks = new Node("blocks", {0, 0, 0});
+    root->addChild(blocks);
+    for (int i = 0; i < 10; ++i) {
+        for (int j = 0; j < 10; ++j) {
+            float h = rnd(5, 30);
+            blocks->addChild(box("b" + to_string(i) + "_" + to_string(j), {-45.0f + 10 * i, 0, -30.0f - 20 * j},
+                                 AABB::fromMinMax({-2, 0, -2}, {2, h, 2})));
+        }
+    }
+    root->updateWorld();
+
+    // 墙和楼当遮挡体, kiosk这种小东西不算
+    vector<AABB> occluders;
+    for (auto* c : root->children) {
+        if (c->name == "wall" || c->name == "tower") occluders.push_back(c->cachedWorldAABB());
+    }
+    for (auto* c : blocks->children) occluders.push_back(c->cachedWorldAABB());
+
+    OcclusionBuffer ob(W, H);
+    ob.setViewProj(vp);
+    ob.render(occluders);
+    {
+        // 按条带并行, 深度缓冲和单线程的一模一样
+        WorkStealingPool pool(4);
+        OcclusionBuffer ob2(W, H);
+        ob2.setViewProj(vp);
+        ob2.render(occluders, &pool);
+        assert(ob2.depth() == ob.depth());
+    }
+
+    vector<const Node*> frustumOnly, visible;
+    cullAndDraw(root, fr, frustumOnly);
+    cullAndDraw_occlusion(root, fr, ob, visible);
+    cout << "frustum only: " << frustumOnly.size() << ", with occlusion: " << visible.size() << endl;
+    assert(visible.size() < frustumOnly.size());
+
+    auto has = [&](const string& name) {
+        return any_of(visible.begin(), visible.end(), [&](const Node* n) { return n->name == name; });
+    };
+    assert(has("wall") && has("kiosk") && has("tower"));
+    assert(!has("hidden"));
+    // 被剔掉的都在视锥里面 (视锥外的本来就没有)
+    for (auto* n : visible) assert(find(frustumOnly.begin(), frustumOnly.end(), n) != frustumOnly.end());
+
+    delete root;
+    Node::verboseDelete = true;
+}
+
+// 越远LOD越粗糙, 在阈值附近来回动不会来回切.
+void subtest10() {
+    cout << __FUNCTION__ << endl;
+
+    Node::verboseDelete = false;
+    Node* root = new Node("root", {0, 0, 0});
+    for (int i = 0; i < 8; ++i) {
+        Node* n = new Node("tree" + to_string(i), {0, 0, -10.0f * (1 << i)});
+        n->setLocalAABB(AABB::fromMinMax({-1, 0, -1}, {1, 5, 1}));
+        n->lod = make_unique<LodComponent>();
+        n->lod->levels = {{0.01f, 0}, {0.05f, 1}, {0.2f, 2}, {1.0f, 3}};
+        root->addChild(n);
+    }
+    Node* noLod = new Node("rock", {2, 0, -20});
+    noLod->setLocalAABB(AABB::fromMinMax({-1, 0, -1}, {1, 1, 1}));
+    root->addChild(noLod);
+    root->updateWorld();
+
+    const float fovy = 60.0f * 3.14159265f / 180.0f;
+    Frustum fr = Frustum::fromMatrix(perspective(fovy, 16.0f / 9, 0.1f, 5000.0f) * lookAt({0, 1, 0}, {0, 1, -1}, {0, 1, 0}));
+    LodParams params = LodParams::fromPerspective({0, 1, 0}, fovy, 1080);
+
+    vector<DrawItem> items;
+    cullAndSelectLod(root, fr, params, items);
+    assert(items.size() == 9);
+    int prev = 0;
+    for (auto& it : items) {
+        cout << it.node->name << ": lod " << it.lod << endl;
+        if (it.lod < 0) {
+            assert(it.node == noLod);
+            continue;
+        }
+        assert(it.lod >= prev);
+        prev = it.lod;
+    }
+    assert(items.front().lod == 0 && items[7].lod == 3);
+
+    // tree3在z=-80附近, level 1 -> 2 的距离 (sse(0.2) == 1像素) 上来回抖动1%, 级别不变
+    const Node* t = root->children[3];
+    float switchDist = 0.2f * params.projScale / params.threshold;
+    vector<int> seen;
+    for (int frame = 0; frame < 6; ++frame) {
+        float d = switchDist * ((frame % 2) ? 1.01f : 0.99f);
+        params.eye = {0, 1, t->cachedWorldAABB().max.z + d};
+        items.clear();
+        cullAndSelectLod(root, fr, params, items);
+        for (auto& it : items) {
+            if (it.node == t) seen.push_back(it.lod);
+        }
+    }
+    assert(seen.size() == 6);
+    for (int l : seen) assert(l == seen[0]);
+    cout << "hysteresis: " << t->name << " stays at lod " << seen[0] << endl;
+
+    // 走远很多, 超过hysteresis的范围, 才变粗
+    params.eye = {0, 1, t->cachedWorldAABB().max.z + switchDist * 1.5f};
+    items.clear();
+    cullAndSelectLod(root, fr, params, items);
+    for (auto& it : items) {
+        if (it.node == t) assert(it.lod == seen[0] + 1);
+    }
+
+    delete root;
+    Node::verboseDelete = true;
+}
+
+// Node的析构不递归, 很深的链也不会爆栈.
+void subtest11() {
+    cout << __FUNCTION__ << endl;
+
+    Node::verboseDelete = false;
+    const size_t depth = 100000;
+    // 从下往上建, addChild往上累加subtreeCount, 从上往下建是O(depth^2).
+    Node* chain = new Node(to_string(depth - 1), {1, 0, 0});
+    for (size_t i = depth - 1; i-- > 0;) {
+        Node* p = new Node(to_string(i), {1, 0, 0});
+        p->addChild(chain);
+        chain = p;
+    }
+    delete chain;
+    cout << "deep chain: " << depth << " nodes" << endl;
+
+    Node::verboseDelete = true;
+}
+
+// 写成文件再mmap回来, 不解析不拷贝, 裁剪结果和Node一样. 坏文件open失败.
+void subtest12() {
+    cout << __FUNCTION__ << endl;
+
+    Node::verboseDelete = false;
+    const size_t n = 20000;
+    srand(46);
+    Node* root = buildRandomTree(n);
+    root->updateWorld();
+
+    const string path = (filesystem::temp_directory_path() / "gfx_tree_scene.bin").string();
+    bool ok;
+    {
+        SceneStorage scene = SceneStorage::fromTree(root);
+        scene.updateWorld();
+        ok = writeSceneFile(path, scene);
+        assert(ok);
+        // 文件里只能有一个root
+        SceneStorage forest;
+        forest.create("a", {0, 0, 0});
+        forest.create("b", {0, 0, 0});
+        forest.updateWorld();
+        assert(!writeSceneFile(path + ".forest", forest));
+    }
+
+    MappedScene ms;
+    ok = ms.open(path);
+    assert(ok);
+    assert(ms.size() == n);
+    assert(ms.name(0) == "root" && ms.node(0).subtreeSize == n);
+
+    Frustum fr = Frustum::fromBox(AABB::fromMinMax({-15, -15, -15}, {15, 15, 15}));
+    vector<const Node*> ref;
+    cullAndDraw(root, fr, ref);
+    vector<uint32_t> visible;
+    ms.prefetchSubtree(0);
+    ms.cull(fr, visible);
+    assert(visible.size() == ref.size());
+    for (size_t i = 0; i < ref.size(); ++i) {
+        assert(ms.name(visible[i]) == ref[i]->name);
+        assert(ms.worldAABB_self(visible[i]).min == ref[i]->cachedWorldAABB().min);
+    }
+    cout << "mapped nodes: " << ms.size() << ", visible: " << visible.size() << endl;
+
+    // 坏文件: 截断, 版本不对
+    {
+        ifstream in(path, ios::binary);
+        string bytes((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        const string bad = path + ".bad";
+        ofstream(bad, ios::binary).write(bytes.data(), bytes.size() / 2);
+        MappedScene m2;
+        assert(!m2.open(bad));
+        bytes[8] = char(SCENE_FILE_VERSION + 1);
+        ofstream(bad, ios::binary | ios::trunc).write(bytes.data(), bytes.size());
+        assert(!m2.open(bad));
+        bytes[8] = char(SCENE_FILE_VERSION);
+
+        // 坏的节点记录: 头是对的, 也要打不开
+        SceneFileHeader h;
+        memcpy(&h, bytes.data(), sizeof(h));
+        auto corrupt = [&](uint32_t i, size_t field, uint32_t value) {
+            m2.close();  // Windows上映射着的文件写不了
+            string b = bytes;
+            memcpy(&b[h.nodesOffset + i * sizeof(SceneFileNode) + field], &value, sizeof(value));
+            ofstream(bad, ios::binary | ios::trunc).write(b.data(), b.size());
+            return m2.open(bad);
+        };
+        SceneFileNode rec5;
+        memcpy(&rec5, &bytes[h.nodesOffset + 5 * sizeof(SceneFileNode)], sizeof(rec5));
+        assert(corrupt(5, offsetof(SceneFileNode, parent), rec5.parent));                   // 对照: 原值能打开
+        assert(!corrupt(5, offsetof(SceneFileNode, subtreeSize), 0));                       // cull会死循环
+        assert(!corrupt(5, offsetof(SceneFileNode, subtreeSize), uint32_t(n)));             // 超出文件
+        assert(!corrupt(5, offsetof(SceneFileNode, parent), 7));                            // parent在后面
+        assert(!corrupt(5, offsetof(SceneFileNode, parent), UINT32_MAX));                   // 第二个root
+        assert(!corrupt(0, offsetof(SceneFileNode, parent), 0));                            // root有parent
+        assert(!corrupt(5, offsetof(SceneFileNode, nameOffset), uint32_t(h.stringBytes)));  // 名字越界
+        assert(!corrupt(5, offsetof(SceneFileNode, nameLength), UINT32_MAX));
+
+        // 坏的头: 偏移加长度溢出绕回来
+        auto corruptHeader = [&](SceneFileHeader bh) {
+            m2.close();
+            string b = bytes;
+            memcpy(&b[0], &bh, sizeof(bh));
+            ofstream(bad, ios::binary | ios::trunc).write(b.data(), b.size());
+            return m2.open(bad);
+        };
+        assert(corruptHeader(h));  // 对照
+        SceneFileHeader bh = h;
+        bh.stringBytes = UINT64_MAX - h.stringsOffset + 1;  // stringsOffset + stringBytes == 0
+        assert(!corruptHeader(bh));
+        bh = h;
+        bh.nodesOffset = 0 - uint64_t(h.nodeCount) * sizeof(SceneFileNode);  // 节点数组的结尾绕回0
+        assert(!corruptHeader(bh));
+        bh = h;
+        bh.nodesOffset = 0;  // 和头重叠
+        assert(!corruptHeader(bh));
+        bh = h;
+        bh.stringsOffset = h.fileSize + 16;
+        bh.stringBytes = 0;
+        assert(!corruptHeader(bh));
+        m2.close();
+        filesystem::remove(bad);
+    }
+    MappedScene m3;
+    assert(!m3.open(path + ".missing"));
+    // Windows上映射着的文件删不掉
+    ms.close();
+    filesystem::remove(path);
+
+    delete root;
+    Node::verboseDelete = true;
+}
+
+// 一排8个tile, 相机沿着x走: 近的加载, 按速度提前加载前面的, 超预算按LRU卸载.
+void subtest13() {
+    cout << __FUNCTION__ << endl;
+
+    Node::verboseDelete = false;
+    const auto dir = filesystem::temp_directory_path() / "gfx_tree_stream";
+    filesystem::create_directories(dir);
+
+    const int tiles = 8, tileNodes = 200;
+    auto rnd = [](float lo, float hi) { return lo + (hi - lo) * rand() / RAND_MAX; };
+    srand(47);
+    Node* root = new Node("world", {0, 0, 0});
+    vector<Node*> placeholders;
+    vector<string> paths;
+    for (int k = 0; k < tiles; ++k) {
+        SceneStorage tile;
+        SceneHandle troot = tile.create("tile" + to_string(k), {0, 0, 0});
+        for (int i = 1; i < tileNodes; ++i) {
+            SceneHandle h = tile.create("poi" + to_string(i), {rnd(-18, 18), 0, rnd(-18, 18)}, troot);
+            tile.setLocalAABB(h, AABB::fromCenterExtent({0, 1, 0}, {1, 1, 1}));
+        }
+        tile.updateWorld();
+        paths.push_back((dir / ("tile" + to_string(k) + ".bin")).string());
+        bool ok = writeSceneFile(paths.back(), tile);
+        assert(ok);
+
+        Node* ph = new Node("tile" + to_string(k), {100.0f * k, 0, 0});
+        root->addChild(ph);
+        placeholders.push_back(ph);
+    }
+    root->updateWorld();
+
+    {
+        WorkStealingPool pool(2);
+        StreamingManager::Config cfg;
+        cfg.loadRadius = 60;
+        cfg.prefetchSeconds = 2;
+        cfg.budgetBytes = 3 * tileNodes * (sizeof(Node) + 8);
+        StreamingManager sm(pool, cfg);
+        for (int k = 0; k < tiles; ++k) {
+            bool ok = sm.addPlaceholder(placeholders[k], paths[k]);
+            assert(ok);
+        }
+
+        auto step = [&](float x, float vx) {
+            sm.update({x, 0, 0}, {vx, 0, 0});
+            sm.waitIdle();
+            root->updateWorld();
+            cout << "camera x=" << x << " vx=" << vx << ", resident:";
+            for (int k = 0; k < tiles; ++k) {
+                if (sm.isResident(placeholders[k])) cout << " " << k;
+            }
+            cout << endl;
+            assert(sm.usedBytes() <= cfg.budgetBytes);
+        };
+
+        step(0, 0);
+        assert(sm.isResident(placeholders[0]) && !sm.isResident(placeholders[1]));
+        // 往+x走, 2秒以后到x=80, tile1提前加载
+        step(0, 40);
+        assert(sm.isResident(placeholders[1]));
+        // 先停在x=100只用tile1, 再回到x=0只用tile0: tile0和tile1的lastUsed不同, 而且tile1更旧.
+        // 遍历顺序里tile0在前, 如果不是按LRU挑, 会卸错成tile0.
+        step(100, 0);
+        step(0, 0);
+        assert(sm.isResident(placeholders[0]) && sm.isResident(placeholders[1]) && sm.evictions() == 0);
+        // 到了x=300, 要tile3和tile4, 预算只有3个tile, tile1最久没用, 卸掉
+        step(300, 40);
+        assert(sm.isResident(placeholders[3]) && sm.isResident(placeholders[4]));
+        assert(sm.isResident(placeholders[0]) && !sm.isResident(placeholders[1]));
+        assert(sm.evictions() == 1);
+        assert(root->subtreeCount == size_t(1 + tiles + 3 * tileNodes));
+
+        // 加载进来的子树和文件里的一样
+        AABB agg = placeholders[3]->children[0]->cachedWorldAABB_aggregate();
+        assert(placeholders[3]->children[0]->subtreeCount == size_t(tileNodes));
+        assert(agg.min.x >= 300 - 20 && agg.max.x <= 300 + 20);
+    }
+
+    delete root;
+    filesystem::remove_all(dir);
+    Node::verboseDelete = true;
+}
+
+// 按名字O(1)查找, addChild/removeChild/delete以后索引还是对的.
+void subtest14() {
+    cout << __FUNCTION__ << endl;
+
+    Node::verboseDelete = false;
+    srand(48);
+    const size_t n = 20000;
+    Node* root = buildRandomTree(n);
+    SceneIndex index;
+    index.attach(root);
+    assert(index.size() == n);
+
+    // 和遍历整棵树比名字的结果一样
+    function<const Node*(const Node*, const string&)> scan = [&](const Node* x, const string& name) -> const Node* {
+        if (x->name == name) return x;
+        for (auto* c : x->children) {
+            if (auto* r = scan(c, name)) return r;
+        }
+        return nullptr;
+    };
+    for (int i = 0; i < 100; ++i) {
+        string name = to_string(rand() % n);
+        assert(index.find(name) == scan(root, name));
+    }
+    assert(index.find("nope") == nullptr);
+
+    // 加一棵有重名的子树
+    Node* extra = createNode("dup", {0, 0, 0}, {createNode("dup", {1, 0, 0}), createNode("5", {2, 0, 0})});
+    Node* host = index.find("123");
+    host->addChild(extra);
+    assert(index.size() == n + 3);
+    NameId dup = index.idOf("dup");
+    int dupCnt = 0;
+    index.forEach(dup, [&](Node*) { dupCnt++; });
+    assert(dupCnt == 2);
+    int fiveCnt = 0;
+    index.forEach(index.idOf("5"), [&](Node*) { fiveCnt++; });
+    assert(fiveCnt == 2);
+
+    // 摘下来就查不到了, 原来的"5"还在
+    host->removeChild(extra);
+    assert(index.size() == n && index.find(dup) == nullptr);
+    assert(index.find("5") == scan(root, "5"));
+    delete extra;
+
+    // delete一棵子树, 里面的节点都从索引里拿掉
+    Node* victim = root->children[0];
+    size_t victimCnt = victim->subtreeCount;
+    delete root->removeChild(victim);
+    assert(index.size() == n - victimCnt);
+
+    // 很多节点同名: 删掉链表头, 尾, 中间的, 剩下的链表前后都还连着
+    Node* group = new Node("group", {0, 0, 0});
+    vector<Node*> meshes;
+    for (int i = 0; i < 1000; ++i) {
+        meshes.push_back(new Node("mesh", {0, 0, 0}));
+        group->addChild(meshes.back());
+    }
+    root->addChild(group);
+    NameId mesh = index.idOf("mesh");
+    for (size_t i = 0; i < meshes.size(); i += 3) delete group->removeChild(meshes[i]);
+    int meshCnt = 0;
+    index.forEach(mesh, [&](Node* m) {
+        assert(m->name == "mesh" && m->index == &index);
+        meshCnt++;
+    });
+    assert(meshCnt == 1000 - 334);
+    delete root->removeChild(group);
+    assert(index.find(mesh) == nullptr && index.size() == n - victimCnt);
+    cout << "indexed: " << index.size() << " nodes" << endl;
+
+    delete root;
+    assert(index.size() == 0);
+    Node::verboseDelete = true;
+}
+
+// 批量更新和整个重算结果一样, 重算的节点少; 读front的线程和写back的模拟线程互不影响.
+void subtest15() {
+    cout << __FUNCTION__ << endl;
+
+    Node::verboseDelete = false;
+    srand(49);
+    const size_t n = 20000;
+    Node* root = buildRandomTree(n);
+    SceneStorage s = SceneStorage::fromTree(root);
+    SceneStorage ref = SceneStorage::fromTree(root);
+    delete root;
+    s.updateWorld();
+    s.publish();
+
+    auto rnd = [](float lo, float hi) { return lo + (hi - lo) * rand() / RAND_MAX; };
+    // 同样的修改直接改到ref上, ref每次整个重算
+    auto randomBatch = [&](size_t edits) {
+        TransformBatch b;
+        for (size_t i = 0; i < edits; ++i) {
+            // 后一半的节点, 大多在比较深的地方, 有重复的
+            SceneHandle h{uint32_t(n / 2 + rand() % (n / 2))};
+            vec3 t = {rnd(-10, 10), rnd(-10, 10), rnd(-10, 10)};
+            b.setLocalTranslation(h, t);
+            ref.setLocalTranslation(h, t);
+        }
+        return b;
+    };
+    auto sameAsRef = [&]() {
+        ref.updateWorld();
+        for (uint32_t id = 0; id < n; ++id) {
+            SceneHandle h{id};
+            assert(s.worldTranslation(h) == ref.worldTranslation(h));
+            assert(s.worldAABB_aggregate(h).min == ref.worldAABB_aggregate(h).min);
+            assert(s.worldAABB_aggregate(h).max == ref.worldAABB_aggregate(h).max);
+        }
+    };
+
+    Frustum fr = Frustum::fromBox(AABB::fromMinMax({-15, -15, -15}, {15, 15, 15}));
+    for (int frame = 0; frame < 3; ++frame) {
+        // 读线程看到的是上一帧publish的结果
+        vector<SceneHandle> expected;
+        ref.updateWorld();
+        ref.traverse([&](SceneHandle h) {
+            if (!aabbInsideFrustum(ref.worldAABB_aggregate(h), fr)) return false;
+            if (aabbInsideFrustum(ref.worldAABB_self(h), fr)) expected.push_back(h);
+            return true;
+        });
+        TransformBatch b = randomBatch(500);
+        size_t recomputed = 0;
+        thread reader([&] {
+            for (int k = 0; k < 5; ++k) {
+                vector<SceneHandle> vis;
+                s.cullFront(fr, vis);
+                assert(vis.size() == expected.size());
+                for (size_t i = 0; i < vis.size(); ++i) assert(vis[i].id == expected[i].id);
+            }
+        });
+        recomputed = s.applyBatch(b);
+        reader.join();
+        sameAsRef();
+        s.publish();
+        cout << "frame " << frame << ": edits " << b.size() << ", recomputed " << recomputed << " / " << n << endl;
+        // 第一帧front是updateWorld()整个算的, back要整个补一次
+        assert(frame == 0 || recomputed < n / 2);
+    }
+
+    // 没有修改的帧 (只publish, 或者空的batch): front还是最新的, 不能退回两帧以前
+    auto frontSameAsRef = [&]() {
+        ref.updateWorld();
+        for (uint32_t id = 0; id < n; ++id) {
+            SceneHandle h{id};
+            assert(s.frontWorldTranslation(h) == ref.worldTranslation(h));
+            assert(s.frontWorldAABB_aggregate(h).min == ref.worldAABB_aggregate(h).min);
+            assert(s.frontWorldAABB_aggregate(h).max == ref.worldAABB_aggregate(h).max);
+        }
+    };
+    frontSameAsRef();
+    s.publish();
+    frontSameAsRef();
+    s.applyBatch(TransformBatch{});
+    s.publish();
+    frontSameAsRef();
+    for (int frame = 0; frame < 2; ++frame) {
+        s.applyBatch(randomBatch(500));
+        s.publish();
+        frontSameAsRef();
+        s.publish();
+        frontSameAsRef();
+        s.applyBatch(TransformBatch{});
+        s.publish();
+        frontSameAsRef();
+        s.publish();
+        frontSameAsRef();
+    }
+    sameAsRef();
+
+    Node::verboseDelete = true;
+}
+
+// 4种形状的场景, Node树和SceneStorage结果一样. RUN_SCENE_BENCH = 1 的时候跑10^3到10^7的benchmark.
+void subtest16() {
+    cout << __FUNCTION__ << endl;
+
+    Node::verboseDelete = false;
+    const SceneShape shapes[] = {SceneShape::Random, SceneShape::Balanced, SceneShape::DeepChain, SceneShape::WideFanout};
+    for (SceneShape shape : shapes) {
+        SceneSpec spec = generateSceneSpec(shape, 1000, 1234);
+        SceneBenchResult r = benchScene(shape, 1000, false);
+        if (!r.recursiveSkipped) assert(r.visibleNode == r.visibleStorage);
+        cout << shapeName(shape) << ": depth " << spec.maxDepth() << ", visible " << r.visibleStorage << endl;
+    }
+    // 10万层的链, Node只建和删 (都不递归)
+    SceneBenchResult r = benchScene(SceneShape::DeepChain, 100000, false);
+    assert(r.recursiveSkipped);
+
+#if RUN_SCENE_BENCH
+    for (size_t n = 1000; n <= 10000000; n *= 10) {
+        for (SceneShape shape : shapes) benchScene(shape, n, true);
+    }
+#endif
+    Node::verboseDelete = true;
+}
+
+int cppMain() {
+    subtest1();
+    subtest2();
+    subtest3();
+    subtest4();
+    subtest5();
+    subtest6();
+    subtest7();
+    subtest8();
+    subtest9();
+    subtest10();
+    subtest11();
+    subtest12();
+    subtest13();
+    subtest14();
+    subtest15();
+    subtest16();
+
+    return 0;
+}
+
+}  // namespace gfx_tree
+
+/*===== Output =====
+
+[RUN  ] gfx_tree
+subtest1
+build tree.
+traverse tree.
+name=root, translation=(0, 0, 0)
+  name=1, translation=(1, 2, 3)
+    name=2, translation=(4, 5, 6)
+    name=3, translation=(7, 8, 9)
+    name=4, translation=(10, 11, 12)
   name=5, translation=(4, 5, 6)
     name=6, translation=(4, 5, 6)
     name=7, translation=(7, 8, 9)
@@ -656,7 +3412,71 @@ subtest2
 Deleting node: root
 Deleting node: car
 Deleting node: wheel
-[tid=1] [Memory Report] globalNewCnt = 42, globalDeleteCnt = 42, globalNewMemSize = 4352, globalDeleteMemSize = 4352
+subtest3
+transformed 37 boxes.
+subtest4
+Deleting node: root
+Deleting node: car
+Deleting node: wheel
+pre-order: root a c b d 
+pre-order after reparent: root a c d b 
+subtest5
+frame 1 updated: 5
+frame 3 updated: 3
+Deleting node: root
+Deleting node: car
+Deleting node: wheel_L
+Deleting node: wheel_R
+Deleting node: driver
+Deleting node: building
+subtest6
+parallel updated: 20000
+visible: 8303 / 20000
+subtest7
+frame 0: visible 6187, plane tests naive 106025, masked 35552
+frame 1: visible 5903, plane tests naive 101741, masked 31931
+frame 2: visible 5600, plane tests naive 97257, masked 30936
+subtest8
+view 0: visible 5909
+view 1: visible 1619
+view 2: visible 5335
+view 3: visible 13586
+view 4: visible 19449
+view 5: visible 28
+subtest9
+frustum only: 104, with occlusion: 22
+subtest10
+tree0: lod 0
+tree1: lod 0
+tree2: lod 0
+tree3: lod 1
+tree4: lod 1
+tree5: lod 2
+tree6: lod 2
+tree7: lod 3
+rock: lod -1
+hysteresis: tree3 stays at lod 1
+subtest11
+deep chain: 100000 nodes
+subtest12
+mapped nodes: 20000, visible: 5466
+subtest13
+camera x=0 vx=0, resident: 0
+camera x=0 vx=40, resident: 0 1
+camera x=100 vx=0, resident: 0 1
+camera x=0 vx=0, resident: 0 1
+camera x=300 vx=40, resident: 0 3 4
+subtest14
+indexed: 8825 nodes
+subtest15
+frame 0: edits 500, recomputed 20000 / 20000
+frame 1: edits 500, recomputed 4752 / 20000
+frame 2: edits 500, recomputed 5767 / 20000
+subtest16
+random: depth 15, visible 520
+balanced: depth 6, visible 479
+deep-chain: depth 1000, visible 999
+wide-fanout: depth 2, visible 999
 [   OK] gfx_tree
 
 */
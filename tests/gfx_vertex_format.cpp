@@ -0,0 +1,526 @@
+#include <assert.h>
+#include <string.h>  // memcpy
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>  // rand
+#include <iostream>
+#include <vector>
+using namespace std;
+
+#if defined(__AVX2__) || defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+#include "aabb.h"
+#include "vec3.h"
+
+namespace gfx_vertex_format {
+
+//=========================================================
+// gfx_vertex_format
+/*
+压缩的顶点/位置格式, 给大数组用 (quad tree的点, scene graph的translation等).
+    vec3 是 3个float, 12 byte, 一百万个节点光translation就 12MB.
+    位置往往不需要32bit精度, 换成下面几种存储格式:
+    | 格式            | 大小   | 精度                         | 说明 |
+    | --------------- | ------ | ---------------------------- | ---- |
+    | vec3 (float)    | 12 byte| 24bit尾数                    | 原始 |
+    | half3           | 6 byte | 11bit尾数, 相对误差 2^-11     | 不需要范围, 但是离原点越远越不准 |
+    | unorm16x3       | 6 byte | AABB尺寸 / 65535             | 相对一个AABB量化, 误差在整个范围内均匀 |
+    | packed1010102   | 4 byte | AABB尺寸 / 1023              | xyz各10bit, 剩下2bit给flag用 |
+
+    存储/带宽就是 1/2 或者 1/3, 用的时候再解压成 vec3 batch.
+    解压/压缩都是逐分量的, 可以直接把 vec3 数组当成 float 数组做SIMD:
+        half:    F16C 的 _mm256_cvtps_ph / _mm256_cvtph_ps, 一次8个float.
+        unorm16: 3个分量的 offset/scale 不一样, 3和8的最小公倍数是24,
+                 一次处理 8个vec3 = 24个float = 3个寄存器, scale提前排好3个pattern.
+        1010102: 一个uint32装一个vec3, 要按分量拆开, 用 gather 把8个x/y/z分别读进来.
+    每个格式都有一个 _scalar 版本, SIMD版本处理不了的尾巴也用它, test里面也拿它做参考.
+*/
+
+static_assert(sizeof(vec3) == 3 * sizeof(float), "vec3 must be 3 tightly packed floats");
+
+//=========================================================
+// half float, IEEE 754 binary16: 1bit符号, 5bit指数(bias 15), 10bit尾数
+
+struct half3 {
+    uint16_t x, y, z;
+};
+static_assert(sizeof(half3) == 3 * sizeof(uint16_t), "half3 must be tightly packed");
+
+// round to nearest even, 和F16C的结果一致.
+uint16_t floatToHalf(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t mant = x & 0x7fffff;
+    int32_t exp = (x >> 23) & 0xff;
+
+    // inf/nan
+    if (exp == 0xff) {
+        return sign | 0x7c00 | (mant ? 0x200 : 0);
+    }
+
+    int32_t e = exp - 127 + 15;
+    // 太大, 变成inf
+    if (e >= 0x1f) {
+        return sign | 0x7c00;
+    }
+    // 太小, 变成subnormal或者0
+    if (e <= 0) {
+        if (e < -10) {
+            return sign;
+        }
+        mant |= 0x800000;  // 补上隐含的1
+        uint32_t shift = 14 - e;
+        uint32_t h = mant >> shift;
+        uint32_t rem = mant & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rem > halfway || (rem == halfway && (h & 1))) h++;
+        return sign | h;
+    }
+
+    uint32_t h = (e << 10) | (mant >> 13);
+    uint32_t rem = mant & 0x1fff;
+    // 进位可能进到指数里面, 刚好是对的 (最大就进位成inf)
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) h++;
+    return sign | h;
+}
+
+float halfToFloat(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t x;
+    if (exp == 0) {
+        if (mant == 0) {
+            x = sign;
+        } else {
+            // subnormal, 规格化成float
+            exp = 1;
+            while (!(mant & 0x400)) {
+                mant <<= 1;
+                exp--;
+            }
+            mant &= 0x3ff;
+            x = sign | ((exp + 112) << 23) | (mant << 13);
+        }
+    } else if (exp == 0x1f) {
+        x = sign | 0x7f800000 | (mant << 13);
+    } else {
+        x = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+void packHalf_scalar(const vec3* in, half3* out, size_t n) {
+    const float* src = &in[0].x;
+    uint16_t* dst = &out[0].x;
+    for (size_t i = 0; i < n * 3; ++i) {
+        dst[i] = floatToHalf(src[i]);
+    }
+}
+
+void unpackHalf_scalar(const half3* in, vec3* out, size_t n) {
+    const uint16_t* src = &in[0].x;
+    float* dst = &out[0].x;
+    for (size_t i = 0; i < n * 3; ++i) {
+        dst[i] = halfToFloat(src[i]);
+    }
+}
+
+void packHalf(const vec3* in, half3* out, size_t n) {
+    size_t i = 0;
+#ifdef __F16C__
+    const float* src = &in[0].x;
+    uint16_t* dst = &out[0].x;
+    // 当成3n个float, 一次8个.
+    for (; i + 8 <= n * 3; i += 8) {
+        __m256 v = _mm256_loadu_ps(src + i);
+        __m128i h = _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i*)(dst + i), h);
+    }
+    // 尾巴按整个vec3算, i不一定是3的倍数, 退回到所在的vec3开头重算.
+    i /= 3;
+#endif
+    packHalf_scalar(in + i, out + i, n - i);
+}
+
+void unpackHalf(const half3* in, vec3* out, size_t n) {
+    size_t i = 0;
+#ifdef __F16C__
+    const uint16_t* src = &in[0].x;
+    float* dst = &out[0].x;
+    for (; i + 8 <= n * 3; i += 8) {
+        __m128i h = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+    }
+    i /= 3;
+#endif
+    unpackHalf_scalar(in + i, out + i, n - i);
+}
+
+//=========================================================
+// 相对AABB量化: q = round((p - min) / (max - min) * maxQ)
+// 解压: p = min + q * (max - min) / maxQ
+
+struct Quantizer {
+    float offset[3];
+    float scale[3];     // 压缩用
+    float invScale[3];  // 解压用
+
+    Quantizer(const AABB& box, float maxQ) {
+        const float mn[3] = {box.min.x, box.min.y, box.min.z};
+        const float mx[3] = {box.max.x, box.max.y, box.max.z};
+        for (int k = 0; k < 3; ++k) {
+            float size = mx[k] - mn[k];
+            offset[k] = mn[k];
+            // 扁平的AABB (size=0), 这个分量全部量化成0.
+            scale[k] = size > 0 ? maxQ / size : 0.0f;
+            invScale[k] = size / maxQ;
+        }
+    }
+
+    // 超出AABB的点clamp到边上.
+    uint32_t quantize(float p, int k, float maxQ) const {
+        float t = (p - offset[k]) * scale[k];
+        t = std::min(std::max(t, 0.0f), maxQ);
+        return (uint32_t)(t + 0.5f);
+    }
+    float dequantize(uint32_t q, int k) const {
+        return offset[k] + (float)q * invScale[k];
+    }
+};
+
+struct unorm16x3 {
+    uint16_t x, y, z;
+};
+static_assert(sizeof(unorm16x3) == 3 * sizeof(uint16_t), "unorm16x3 must be tightly packed");
+
+constexpr float UNORM16_MAX = 65535.0f;
+
+void packUnorm16_scalar(const vec3* in, unorm16x3* out, size_t n, const AABB& box) {
+    Quantizer qz(box, UNORM16_MAX);
+    const float* src = &in[0].x;
+    uint16_t* dst = &out[0].x;
+    for (size_t i = 0; i < n * 3; ++i) {
+        dst[i] = (uint16_t)qz.quantize(src[i], i % 3, UNORM16_MAX);
+    }
+}
+
+void unpackUnorm16_scalar(const unorm16x3* in, vec3* out, size_t n, const AABB& box) {
+    Quantizer qz(box, UNORM16_MAX);
+    const uint16_t* src = &in[0].x;
+    float* dst = &out[0].x;
+    for (size_t i = 0; i < n * 3; ++i) {
+        dst[i] = qz.dequantize(src[i], i % 3);
+    }
+}
+
+#ifdef __AVX2__
+// 24个float (8个vec3) 对应的分量是 xyzxyzxy zxyzxyzx yzxyzxyz, 提前排好3个寄存器.
+static void loadPattern24(const float perAxis[3], __m256 pattern[3]) {
+    alignas(32) float tmp[24];
+    for (int i = 0; i < 24; ++i) {
+        tmp[i] = perAxis[i % 3];
+    }
+    for (int r = 0; r < 3; ++r) {
+        pattern[r] = _mm256_load_ps(tmp + r * 8);
+    }
+}
+#endif
+
+void packUnorm16(const vec3* in, unorm16x3* out, size_t n, const AABB& box) {
+    size_t i = 0;
+#ifdef __AVX2__
+    Quantizer qz(box, UNORM16_MAX);
+    __m256 offset[3], scale[3];
+    loadPattern24(qz.offset, offset);
+    loadPattern24(qz.scale, scale);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 maxQ = _mm256_set1_ps(UNORM16_MAX);
+    const __m256 half = _mm256_set1_ps(0.5f);
+
+    const float* src = &in[0].x;
+    uint16_t* dst = &out[0].x;
+    // 一次8个vec3
+    for (; i + 8 <= n; i += 8) {
+        __m256i q[3];
+        for (int r = 0; r < 3; ++r) {
+            __m256 t = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(src + i * 3 + r * 8), offset[r]), scale[r]);
+            t = _mm256_min_ps(_mm256_max_ps(t, zero), maxQ);
+            q[r] = _mm256_cvttps_epi32(_mm256_add_ps(t, half));
+        }
+        // packus是在128bit lane里面交错的, permute回正常顺序.
+        __m256i q01 = _mm256_permute4x64_epi64(_mm256_packus_epi32(q[0], q[1]), 0xD8);
+        __m128i q2 = _mm_packus_epi32(_mm256_castsi256_si128(q[2]), _mm256_extracti128_si256(q[2], 1));
+        _mm256_storeu_si256((__m256i*)(dst + i * 3), q01);
+        _mm_storeu_si128((__m128i*)(dst + i * 3 + 16), q2);
+    }
+#endif
+    packUnorm16_scalar(in + i, out + i, n - i, box);
+}
+
+void unpackUnorm16(const unorm16x3* in, vec3* out, size_t n, const AABB& box) {
+    size_t i = 0;
+#ifdef __AVX2__
+    Quantizer qz(box, UNORM16_MAX);
+    __m256 offset[3], invScale[3];
+    loadPattern24(qz.offset, offset);
+    loadPattern24(qz.invScale, invScale);
+
+    const uint16_t* src = &in[0].x;
+    float* dst = &out[0].x;
+    for (; i + 8 <= n; i += 8) {
+        for (int r = 0; r < 3; ++r) {
+            __m256i q = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src + i * 3 + r * 8)));
+            __m256 p = _mm256_add_ps(offset[r], _mm256_mul_ps(_mm256_cvtepi32_ps(q), invScale[r]));
+            _mm256_storeu_ps(dst + i * 3 + r * 8, p);
+        }
+    }
+#endif
+    unpackUnorm16_scalar(in + i, out + i, n - i, box);
+}
+
+//=========================================================
+// 10:10:10:2, x在低10bit, 然后y, z, 最高2bit是w, 这里不用, 留给flag.
+
+struct packed1010102 {
+    uint32_t v;
+    uint32_t w() const { return v >> 30; }
+};
+static_assert(sizeof(packed1010102) == sizeof(uint32_t), "packed1010102 must be 4 bytes");
+
+constexpr float UNORM10_MAX = 1023.0f;
+
+void pack1010102_scalar(const vec3* in, packed1010102* out, size_t n, const AABB& box) {
+    Quantizer qz(box, UNORM10_MAX);
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t qx = qz.quantize(in[i].x, 0, UNORM10_MAX);
+        uint32_t qy = qz.quantize(in[i].y, 1, UNORM10_MAX);
+        uint32_t qz_ = qz.quantize(in[i].z, 2, UNORM10_MAX);
+        out[i].v = qx | (qy << 10) | (qz_ << 20);
+    }
+}
+
+void unpack1010102_scalar(const packed1010102* in, vec3* out, size_t n, const AABB& box) {
+    Quantizer qz(box, UNORM10_MAX);
+    for (size_t i = 0; i < n; ++i) {
+        out[i].x = qz.dequantize(in[i].v & 0x3ff, 0);
+        out[i].y = qz.dequantize((in[i].v >> 10) & 0x3ff, 1);
+        out[i].z = qz.dequantize((in[i].v >> 20) & 0x3ff, 2);
+    }
+}
+
+void pack1010102(const vec3* in, packed1010102* out, size_t n, const AABB& box) {
+    size_t i = 0;
+#ifdef __AVX2__
+    Quantizer qz(box, UNORM10_MAX);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 maxQ = _mm256_set1_ps(UNORM10_MAX);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    // 8个vec3里面x的下标, y/z就是base+1/base+2
+    const __m256i idx = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+
+    const float* src = &in[0].x;
+    for (; i + 8 <= n; i += 8) {
+        __m256i packed = _mm256_setzero_si256();
+        for (int k = 0; k < 3; ++k) {
+            __m256 p = _mm256_i32gather_ps(src + i * 3 + k, idx, 4);
+            __m256 t = _mm256_mul_ps(_mm256_sub_ps(p, _mm256_set1_ps(qz.offset[k])), _mm256_set1_ps(qz.scale[k]));
+            t = _mm256_min_ps(_mm256_max_ps(t, zero), maxQ);
+            __m256i q = _mm256_cvttps_epi32(_mm256_add_ps(t, half));
+            packed = _mm256_or_si256(packed, _mm256_sllv_epi32(q, _mm256_set1_epi32(k * 10)));
+        }
+        _mm256_storeu_si256((__m256i*)(out + i), packed);
+    }
+#endif
+    pack1010102_scalar(in + i, out + i, n - i, box);
+}
+
+void unpack1010102(const packed1010102* in, vec3* out, size_t n, const AABB& box) {
+    size_t i = 0;
+#ifdef __AVX2__
+    Quantizer qz(box, UNORM10_MAX);
+    const __m256i mask = _mm256_set1_epi32(0x3ff);
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(in + i));
+        // 先解成SoA, 再交错写回vec3, AVX2没有scatter.
+        alignas(32) float soa[3][8];
+        for (int k = 0; k < 3; ++k) {
+            __m256i q = _mm256_and_si256(_mm256_srlv_epi32(v, _mm256_set1_epi32(k * 10)), mask);
+            __m256 p = _mm256_add_ps(_mm256_set1_ps(qz.offset[k]),
+                                     _mm256_mul_ps(_mm256_cvtepi32_ps(q), _mm256_set1_ps(qz.invScale[k])));
+            _mm256_store_ps(soa[k], p);
+        }
+        for (int j = 0; j < 8; ++j) {
+            out[i + j] = vec3(soa[0][j], soa[1][j], soa[2][j]);
+        }
+    }
+#endif
+    unpack1010102_scalar(in + i, out + i, n - i, box);
+}
+
+//=========================================================
+// test
+
+// 单个half的转换
+void subtest1() {
+    cout << __FUNCTION__ << endl;
+
+    assert(floatToHalf(0.0f) == 0x0000);
+    assert(floatToHalf(-0.0f) == 0x8000);
+    assert(floatToHalf(1.0f) == 0x3c00);
+    assert(floatToHalf(-2.0f) == 0xc000);
+    assert(floatToHalf(65504.0f) == 0x7bff);     // half能表示的最大值
+    assert(floatToHalf(70000.0f) == 0x7c00);     // 溢出变inf
+    assert(floatToHalf(5.9604645e-8f) == 0x0001);  // 最小的subnormal
+    assert(floatToHalf(1e-9f) == 0x0000);        // 太小变0
+
+    assert(halfToFloat(0x3c00) == 1.0f);
+    assert(halfToFloat(0xc000) == -2.0f);
+    assert(halfToFloat(0x7bff) == 65504.0f);
+    assert(halfToFloat(0x0001) == 5.9604645e-8f);
+    assert(std::isinf(halfToFloat(0x7c00)));
+
+    // 所有非nan的half都能无损来回转换
+    for (uint32_t h = 0; h < 0x10000; ++h) {
+        if ((h & 0x7c00) == 0x7c00 && (h & 0x3ff)) continue;  // nan
+        assert(floatToHalf(halfToFloat((uint16_t)h)) == h);
+    }
+
+    float f = 0.1f;
+    float back = halfToFloat(floatToHalf(f));
+    cout << "0.1f -> half -> float = " << back << endl;
+    assert(fabs(back - f) <= f * (1.0f / 2048));
+}
+
+// 随机点压缩/解压, SIMD和scalar结果要完全一样, 误差在格式的精度以内.
+void subtest2() {
+    cout << __FUNCTION__ << endl;
+
+    srand(41);
+    // 故意不是8的倍数, 测尾巴.
+    const size_t n = 1003;
+    AABB box = AABB::fromMinMax({-100, -50, 0}, {100, 50, 10});
+    vector<vec3> pts(n);
+    for (auto& p : pts) {
+        p = vec3(box.min.x + (box.max.x - box.min.x) * rand() / RAND_MAX,
+                 box.min.y + (box.max.y - box.min.y) * rand() / RAND_MAX,
+                 box.min.z + (box.max.z - box.min.z) * rand() / RAND_MAX);
+    }
+
+    vector<vec3> back(n), backRef(n);
+
+    // half
+    {
+        vector<half3> packed(n), packedRef(n);
+        packHalf(pts.data(), packed.data(), n);
+        packHalf_scalar(pts.data(), packedRef.data(), n);
+        assert(memcmp(packed.data(), packedRef.data(), n * sizeof(half3)) == 0);
+
+        unpackHalf(packed.data(), back.data(), n);
+        unpackHalf_scalar(packed.data(), backRef.data(), n);
+        assert(memcmp(back.data(), backRef.data(), n * sizeof(vec3)) == 0);
+
+        for (size_t i = 0; i < n; ++i) {
+            vec3 d = back[i] - pts[i];
+            // 相对误差 2^-11, 半个ulp
+            assert(fabs(d.x) <= fabs(pts[i].x) / 2048 + 1e-7f);
+            assert(fabs(d.y) <= fabs(pts[i].y) / 2048 + 1e-7f);
+            assert(fabs(d.z) <= fabs(pts[i].z) / 2048 + 1e-7f);
+        }
+        cout << "half3:         " << n * sizeof(half3) << " bytes" << endl;
+    }
+
+    // unorm16
+    {
+        vector<unorm16x3> packed(n), packedRef(n);
+        packUnorm16(pts.data(), packed.data(), n, box);
+        packUnorm16_scalar(pts.data(), packedRef.data(), n, box);
+        assert(memcmp(packed.data(), packedRef.data(), n * sizeof(unorm16x3)) == 0);
+
+        unpackUnorm16(packed.data(), back.data(), n, box);
+        unpackUnorm16_scalar(packed.data(), backRef.data(), n, box);
+        assert(memcmp(back.data(), backRef.data(), n * sizeof(vec3)) == 0);
+
+        // 误差是半个量化步长, 加一点float本身的误差
+        vec3 step = (box.max - box.min) * (1.0f / UNORM16_MAX);
+        for (size_t i = 0; i < n; ++i) {
+            vec3 d = back[i] - pts[i];
+            assert(fabs(d.x) <= step.x * 0.5f + 1e-4f);
+            assert(fabs(d.y) <= step.y * 0.5f + 1e-4f);
+            assert(fabs(d.z) <= step.z * 0.5f + 1e-4f);
+        }
+        cout << "unorm16x3:     " << n * sizeof(unorm16x3) << " bytes" << endl;
+    }
+
+    // 10:10:10:2
+    {
+        vector<packed1010102> packed(n), packedRef(n);
+        pack1010102(pts.data(), packed.data(), n, box);
+        pack1010102_scalar(pts.data(), packedRef.data(), n, box);
+        assert(memcmp(packed.data(), packedRef.data(), n * sizeof(packed1010102)) == 0);
+
+        unpack1010102(packed.data(), back.data(), n, box);
+        unpack1010102_scalar(packed.data(), backRef.data(), n, box);
+        assert(memcmp(back.data(), backRef.data(), n * sizeof(vec3)) == 0);
+
+        vec3 step = (box.max - box.min) * (1.0f / UNORM10_MAX);
+        for (size_t i = 0; i < n; ++i) {
+            vec3 d = back[i] - pts[i];
+            assert(packed[i].w() == 0);
+            assert(fabs(d.x) <= step.x * 0.5f + 1e-4f);
+            assert(fabs(d.y) <= step.y * 0.5f + 1e-4f);
+            assert(fabs(d.z) <= step.z * 0.5f + 1e-4f);
+        }
+        cout << "packed1010102: " << n * sizeof(packed1010102) << " bytes" << endl;
+    }
+
+    cout << "vec3:          " << n * sizeof(vec3) << " bytes" << endl;
+}
+
+// 超出AABB的点clamp到边上, 扁平的AABB不会除0.
+void subtest3() {
+    cout << __FUNCTION__ << endl;
+
+    AABB box = AABB::fromMinMax({0, 0, 5}, {10, 10, 5});  // z方向是扁的
+    vector<vec3> pts = {{-1, 0, 5}, {11, 10, 5}, {10, 0, 7}};
+    vector<unorm16x3> packed(pts.size());
+    vector<vec3> back(pts.size());
+    packUnorm16(pts.data(), packed.data(), pts.size(), box);
+    unpackUnorm16(packed.data(), back.data(), pts.size(), box);
+    assert(back[0] == vec3(0, 0, 5));
+    assert(back[1] == vec3(10, 10, 5));
+    assert(back[2] == vec3(10, 0, 5));
+}
+
+int cppMain() {
+    subtest1();
+    subtest2();
+    subtest3();
+
+    cout << "cppMain done." << endl;
+    return 0;
+}
+
+}  // namespace gfx_vertex_format
+/*===== Output =====
+
+[RUN  ] gfx_vertex_format
+subtest1
+0.1f -> half -> float = 0.0999756
+subtest2
+half3:         6018 bytes
+unorm16x3:     6018 bytes
+packed1010102: 4012 bytes
+vec3:          12036 bytes
+subtest3
+cppMain done.
+[tid=1] [Memory Report] globalNewCnt = 12, globalDeleteCnt = 12, globalNewMemSize = 68822, globalDeleteMemSize = 68822
+[   OK] gfx_vertex_format
+
+*/
@@ -95,7 +95,7 @@ inline vec3 normalize(const vec3& v) {
     return {v.x / len, v.y / len, v.z / len};
 }
 
-vec3 cross(const vec3& l, const vec3& r) {
+inline vec3 cross(const vec3& l, const vec3& r) {
     // 不要求记住这个公式
     return {
         l.y * r.z - l.z * r.y,
@@ -104,7 +104,7 @@ vec3 cross(const vec3& l, const vec3& r) {
     };
 }
 
-vec3 reflect(const vec3& i, const vec3& n) {
+inline vec3 reflect(const vec3& i, const vec3& n) {
     return i - 2 * dot(i, n) * n;
 }
 